@@ -0,0 +1,74 @@
+/* $Id$
+ *
+ * Invertible Bloom lookup table of (kcs, tcs) 64 bit integer pairs,
+ * so that the differences between two tables may be decoded from the
+ * difference of their sketches.
+ *
+ * The table is an array of cells, each holding 4 integers stored
+ * little-endian whatever the host: the item count, the xor of kcs,
+ * the xor of tcs and the xor of an item check hash.
+ * Each item is added to one cell in each of IBLT_HASHES equal partitions.
+ * The very same layout and hashes are used by pg_comparator to decode.
+ *
+ * This file requires "jenkins.c" to be included beforehand.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define IBLT_HASHES 3
+#define IBLT_CELL_SIZE 32
+
+static const uint32_t iblt_seeds[IBLT_HASHES] = { PN_32_1, PN_32_2, PN_32_3 };
+
+// number of cells, rounded to a positive multiple of IBLT_HASHES
+static size_t iblt_cells(int64_t ncells)
+{
+  if (ncells < IBLT_HASHES)
+    return IBLT_HASHES;
+  return (size_t) ncells - (size_t) ncells % IBLT_HASHES;
+}
+
+static int64_t iblt_get(const unsigned char *p)
+{
+  uint64_t v = 0;
+  int i;
+  for (i = 7; i >= 0; i--)
+    v = (v << 8) | p[i];
+  return (int64_t) v;
+}
+
+static void iblt_set(unsigned char *p, int64_t val)
+{
+  uint64_t v = (uint64_t) val;
+  int i;
+  for (i = 0; i < 8; i++, v >>= 8)
+    p[i] = (unsigned char) (v & 0xff);
+}
+
+/* add an item with count delta (1 or -1) to a table of ncells cells.
+ * hashes are computed on the 16 bytes little-endian representation.
+ */
+static void iblt_insert(unsigned char *table, size_t ncells,
+                        int64_t kcs, int64_t tcs, int64_t delta)
+{
+  unsigned char item[16], *cell;
+  size_t part = ncells / IBLT_HASHES;
+  uint32_t check, h;
+  int i;
+
+  iblt_set(item, kcs);
+  iblt_set(item + 8, tcs);
+  check = jenkins_one_at_a_time_hash(PN_32_4, item, sizeof(item));
+
+  for (i = 0; i < IBLT_HASHES; i++)
+  {
+    h = jenkins_one_at_a_time_hash(iblt_seeds[i], item, sizeof(item));
+    cell = table + IBLT_CELL_SIZE * (i * part + h % part);
+    // unsigned arithmetic so that overflows are well defined
+    iblt_set(cell, (int64_t) ((uint64_t) iblt_get(cell) + (uint64_t) delta));
+    iblt_set(cell + 8, iblt_get(cell + 8) ^ kcs);
+    iblt_set(cell + 16, iblt_get(cell + 16) ^ tcs);
+    iblt_set(cell + 24, iblt_get(cell + 24) ^ (int64_t) check);
+  }
+}
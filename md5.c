@@ -0,0 +1,132 @@
+/*
+ * $Id$
+ *
+ * MD5 message digest, see RFC 1321, written from the RFC description
+ * so that pg_comparator extensions do not depend on an external library.
+ * NOT CRYPTOGRAPHICALLY SECURE anymore anyway.
+ *
+ * The integer checksums are the first bytes of the digest read as a
+ * big-endian signed integer, as DECODE(MD5(...),'hex')::BIT(n) casts do
+ * with PostgreSQL, or CONV(LEFT(MD5(...),...),16,10) with MySQL.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define MD5_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+// per round shift amounts
+static const uint8_t md5_shifts[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+// integer part of abs(sin(i+1)) * 2**32
+static const uint32_t md5_sines[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+  0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+  0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+  0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+  0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+  0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+// process one 64 bytes block
+static void md5_block(uint32_t state[4], const unsigned char *block)
+{
+  uint32_t w[16], a = state[0], b = state[1], c = state[2], d = state[3];
+  int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = (uint32_t) block[4*i] | ((uint32_t) block[4*i+1] << 8) |
+      ((uint32_t) block[4*i+2] << 16) | ((uint32_t) block[4*i+3] << 24);
+
+  for (i = 0; i < 64; i++)
+  {
+    uint32_t f, tmp;
+    int g;
+    if (i < 16)
+      f = (b & c) | (~b & d), g = i;
+    else if (i < 32)
+      f = (d & b) | (~d & c), g = (5*i + 1) % 16;
+    else if (i < 48)
+      f = b ^ c ^ d, g = (3*i + 5) % 16;
+    else
+      f = c ^ (b | ~d), g = (7*i) % 16;
+    tmp = d;
+    d = c;
+    c = b;
+    b = b + MD5_ROTL(a + f + md5_sines[i] + w[g], md5_shifts[i]);
+    a = tmp;
+  }
+
+  state[0] += a, state[1] += b, state[2] += c, state[3] += d;
+}
+
+static void md5_digest(const unsigned char *data, size_t len,
+                       unsigned char digest[16])
+{
+  uint32_t state[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  unsigned char last[128];
+  uint64_t bits = (uint64_t) len * 8;
+  size_t rest, padded, i;
+
+  for (; len >= 64; data += 64, len -= 64)
+    md5_block(state, data);
+
+  // append 0x80, zeros and the little-endian bit length
+  rest = len;
+  padded = rest < 56? 64: 128;
+  memcpy(last, data, rest);
+  last[rest] = 0x80;
+  memset(last + rest + 1, 0, padded - rest - 1);
+  for (i = 0; i < 8; i++)
+    last[padded - 8 + i] = (unsigned char) (bits >> (8*i));
+  md5_block(state, last);
+  if (padded == 128)
+    md5_block(state, last + 64);
+
+  for (i = 0; i < 16; i++)
+    digest[i] = (unsigned char) (state[i/4] >> (8*(i%4)));
+}
+
+/* md5 checksums of sizes 2, 4 and 8.
+ * md5_int?(NULL) == 0
+ */
+static uint64_t md5_prefix(const unsigned char *data, size_t size)
+{
+  unsigned char digest[16];
+  uint64_t h = 0;
+  int i;
+  md5_digest(data, size, digest);
+  for (i = 0; i < 8; i++)
+    h = (h << 8) | digest[i];
+  return h;
+}
+
+static int16_t md5_int2(const unsigned char *data, size_t size)
+{
+  return data? (int16_t) (md5_prefix(data, size) >> 48): 0;
+}
+
+static int32_t md5_int4(const unsigned char *data, size_t size)
+{
+  return data? (int32_t) (md5_prefix(data, size) >> 32): 0;
+}
+
+static int64_t md5_int8(const unsigned char *data, size_t size)
+{
+  return data? (int64_t) md5_prefix(data, size): 0;
+}
@@ -169,3 +169,186 @@ my_bool fnv8_init(
 {
   return 0;
 }
+
+/* MD5-based hash functions
+ */
+my_bool md5_8_init(UDF_INIT *, UDF_ARGS *, char *);
+longlong md5_8(UDF_INIT *, UDF_ARGS *, char *, char *);
+my_bool md5_4_init(UDF_INIT *, UDF_ARGS *, char *);
+longlong md5_4(UDF_INIT *, UDF_ARGS *, char *, char *);
+my_bool md5_2_init(UDF_INIT *, UDF_ARGS *, char *);
+longlong md5_2(UDF_INIT *, UDF_ARGS *, char *, char *);
+
+#include "md5.c"
+
+longlong md5_2(
+  UDF_INIT *initid __attribute__((unused)),
+  UDF_ARGS *args,
+  char *is_null,
+  char *error __attribute__((unused)))
+{
+  // if in doubt, return NULL
+  if (args->arg_count!=1 || args->arg_type[0]!=STRING_RESULT)
+  {
+    *is_null = 1;
+    return 0;
+  }
+  return (longlong) md5_int2((unsigned char *) args->args[0],
+                              args->lengths[0]);
+}
+
+my_bool md5_2_init(
+  UDF_INIT *initid __attribute__((unused)),
+  UDF_ARGS *args __attribute__((unused)),
+  char *message __attribute__((unused)))
+{
+  return 0;
+}
+
+longlong md5_4(
+  UDF_INIT *initid __attribute__((unused)),
+  UDF_ARGS *args,
+  char *is_null,
+  char *error __attribute__((unused)))
+{
+  // if in doubt, return NULL
+  if (args->arg_count!=1 || args->arg_type[0]!=STRING_RESULT)
+  {
+    *is_null = 1;
+    return 0;
+  }
+  return (longlong) md5_int4((unsigned char *) args->args[0],
+                              args->lengths[0]);
+}
+
+my_bool md5_4_init(
+  UDF_INIT *initid __attribute__((unused)),
+  UDF_ARGS *args __attribute__((unused)),
+  char *message __attribute__((unused)))
+{
+  return 0;
+}
+
+longlong md5_8(
+  UDF_INIT *initid __attribute__((unused)),
+  UDF_ARGS *args,
+  char *is_null,
+  char *error __attribute__((unused)))
+{
+  // if in doubt, return NULL
+  if (args->arg_count!=1 || args->arg_type[0]!=STRING_RESULT)
+  {
+    *is_null = 1;
+    return 0;
+  }
+  return (longlong) md5_int8((unsigned char *) args->args[0],
+                              args->lengths[0]);
+}
+
+my_bool md5_8_init(
+  UDF_INIT *initid __attribute__((unused)),
+  UDF_ARGS *args __attribute__((unused)),
+  char *message __attribute__((unused)))
+{
+  return 0;
+}
+
+/* Invertible Bloom lookup table aggregate: iblt(ncells, kcs, tcs)
+ */
+my_bool iblt_init(UDF_INIT *, UDF_ARGS *, char *);
+void iblt_deinit(UDF_INIT *);
+void iblt_clear(UDF_INIT *, char *, char *);
+void iblt_add(UDF_INIT *, UDF_ARGS *, char *, char *);
+char * iblt(UDF_INIT *, UDF_ARGS *, char *, unsigned long *, char *, char *);
+
+#include <stdlib.h>
+#include "iblt.c"
+
+typedef struct {
+  size_t ncells;
+  unsigned char * table;
+} iblt_t;
+
+my_bool iblt_init(
+  UDF_INIT *initid,
+  UDF_ARGS *args,
+  char *message)
+{
+  if (args->arg_count!=3)
+  {
+    strcpy(message, "iblt() requires 3 arguments");
+    return 1;
+  }
+  args->arg_type[0] = args->arg_type[1] = args->arg_type[2] = INT_RESULT;
+  initid->ptr = calloc(1, sizeof(iblt_t));
+  if (!initid->ptr)
+  {
+    strcpy(message, "iblt() cannot allocate memory");
+    return 1;
+  }
+  initid->maybe_null = 1;
+  // large enough to be handled as a blob
+  initid->max_length = 16777215;
+  return 0;
+}
+
+void iblt_deinit(UDF_INIT *initid)
+{
+  iblt_t * s = (iblt_t *) initid->ptr;
+  if (s)
+  {
+    free(s->table);
+    free(s);
+  }
+}
+
+void iblt_clear(
+  UDF_INIT *initid,
+  char *is_null __attribute__((unused)),
+  char *error __attribute__((unused)))
+{
+  iblt_t * s = (iblt_t *) initid->ptr;
+  free(s->table);
+  s->table = NULL;
+}
+
+void iblt_add(
+  UDF_INIT *initid,
+  UDF_ARGS *args,
+  char *is_null __attribute__((unused)),
+  char *error)
+{
+  iblt_t * s = (iblt_t *) initid->ptr;
+  if (!s->table)
+  {
+    s->ncells = iblt_cells(args->args[0]? *((longlong *) args->args[0]): 0);
+    s->table = calloc(s->ncells, IBLT_CELL_SIZE);
+    if (!s->table)
+    {
+      *error = 1;
+      return;
+    }
+  }
+  // NULL items are ignored
+  if (args->args[1] && args->args[2])
+    iblt_insert(s->table, s->ncells,
+                *((longlong *) args->args[1]), *((longlong *) args->args[2]), 1);
+}
+
+char * iblt(
+  UDF_INIT *initid,
+  UDF_ARGS *args __attribute__((unused)),
+  char *result __attribute__((unused)),
+  unsigned long *length,
+  char *is_null,
+  char *error __attribute__((unused)))
+{
+  iblt_t * s = (iblt_t *) initid->ptr;
+  if (!s->table)
+  {
+    *is_null = 1;
+    return NULL;
+  }
+  *length = IBLT_CELL_SIZE * s->ncells;
+  return (char *) s->table;
+}
@@ -17,3 +17,15 @@ DROP FUNCTION IF EXISTS fnv2;
 CREATE FUNCTION fnv8 RETURNS INTEGER SONAME 'mysql_checksum.so';
 CREATE FUNCTION fnv4 RETURNS INTEGER SONAME 'mysql_checksum.so';
 CREATE FUNCTION fnv2 RETURNS INTEGER SONAME 'mysql_checksum.so';
+
+DROP FUNCTION IF EXISTS md5_8;
+DROP FUNCTION IF EXISTS md5_4;
+DROP FUNCTION IF EXISTS md5_2;
+
+CREATE FUNCTION md5_8 RETURNS INTEGER SONAME 'mysql_checksum.so';
+CREATE FUNCTION md5_4 RETURNS INTEGER SONAME 'mysql_checksum.so';
+CREATE FUNCTION md5_2 RETURNS INTEGER SONAME 'mysql_checksum.so';
+
+DROP FUNCTION IF EXISTS iblt;
+
+CREATE AGGREGATE FUNCTION iblt RETURNS STRING SONAME 'mysql_checksum.so';
@@ -87,8 +87,11 @@ Default is B<create> because it always works for both databases.
 Checksum function to use, either B<ck>, B<fnv> or B<md5>.
 For PostgreSQL, MySQL and SQLite the provided B<ck> and B<fnv> checksum
 functions must be loaded into the target databases.
-Choosing B<md5> does not come free either: the provided cast functions must be
-loaded into the target databases and the computation is more expensive.
+Choosing B<md5> does not come free either: the provided B<md5_2>, B<md5_4>
+and B<md5_8> functions must also be loaded into the target databases, and the
+computation is more expensive. These functions return the first bytes of the
+MD5 digest as a big-endian signed integer, so that the results are the same
+on all databases.
 
 Default is B<ck>, which is fast, especially if the operation is cpu-bound
 and the bandwidth is reasonably high.
@@ -96,7 +99,7 @@ and the bandwidth is reasonably high.
 =item C<--checksum-size=n> or C<--check-size=n> or C<--cs=n> or C<-z n>
 
 Tuple checksum size, must be B<2>, B<4> or B<8> bytes.
-The key checksum size is always 4 bytes long.
+The key checksum size is set separately with C<--key-checksum-size>.
 
 Default is B<8>, so that the false negative probability is very low.
 There should be no reason to change that.
@@ -119,6 +122,22 @@ This option is useful for debugging.
 Default is B<not> to clear explicitly the checksum and summary tables,
 as it is not needed.
 
+=item C<--column-groups=n>
+
+Split the compared columns into this number of consecutive groups, the
+checksums of which are also stored in the checksum table when synchronizing.
+The group checksums of updated tuples are fetched by batches on both sides
+and compared so that only the columns of the differing groups are fetched
+and updated, which saves bandwidth and writes on wide tuples with large
+rarely changing columns.
+Under C<--pg-copy>, updates are then performed with C<UPDATE> instead of
+being deleted and copied again.
+This option requires building the checksum table, thus does not work with
+C<--tuple-checksum>, and the joined comparison is not chosen when
+synchronizing.
+
+Default is B<0>, i.e. no column groups.
+
 =item C<--debug> or C<-d>
 
 Set debug mode. Repeat for higher debug levels. See also C<--verbose>.
@@ -135,11 +154,34 @@ This is tried before asking interactively if C<--ask-pass> is also set.
 
 Default is not to look for passwords from environment variables.
 
+=item C<--escalate>, C<--no-escalate>
+
+Under C<--sample>, whether to run the full comparison when some sampled
+buckets differ, so as to find the actual differing keys.
+
+Default is not to escalate, only the number of differing sampled buckets
+is reported.
+
 =item C<--expect n> or C<-e n>
 
 Total number of differences to expect (updates, deletes and inserts).
 This option is only used for non regression tests. See the TESTS section.
 
+=item C<--export-tree=file>
+
+Write the key checksums, tuple checksums and keys of the first table, and
+all its summary levels, to this file once they are computed.
+The file is written as the tables are read. It starts with a text header
+which records the masks and the checksum options, followed by fixed size
+binary records for each level, sorted by bucket of the upper level, then the
+keys and a trailer with the number of rows and offset of each level.
+When the file is imported, only the records of the differing buckets are
+read with a binary search, and only their keys are decoded.
+This file may then be given to C<--import-tree> so that the first table is
+not scanned again when it is compared to many copies.
+
+Default is not to export anything.
+
 =item C<--folding-factor=7> or C<-f 7>
 
 Folding factor: log2 of the number of rows grouped together at each stage,
@@ -156,6 +198,65 @@ choice for most settings.
 
 Show short help.
 
+=item C<--iblt=n>
+
+Expected number of differences for a two-round comparison with invertible
+Bloom lookup table sketches. Once the checksum table is built, each side
+computes a sketch of about C<3n> cells of its (key checksum, tuple checksum)
+pairs with the C<IBLT> aggregate, and the client decodes the differing pairs
+from the difference of both sketches. The differing level 0 buckets are then
+fetched in a second round, without building any summary tables.
+If there are too many differences for the sketch size, decoding fails and
+the comparison falls back to the usual summary tables.
+This requires the C<3.2> version of the C<pgcmp> extension for PostgreSQL,
+and is not available for Firebird.
+
+Default is 0, that is not to use sketches.
+
+=item C<--import-tree=file>
+
+Use a file written by C<--export-tree> instead of the first table.
+No connection is made to the first database, although its URL must still be
+provided for its type and the table name. The checksum options, and the
+keys and columns given in the URL if any, must be the same as when the file
+was exported, and the summary tables of the second table are built with the
+masks of the file.
+The first table cannot be synchronized from the file, and this option does
+not work with C<--threads>.
+
+Default is to compare two live tables.
+
+=item C<--join>, C<--no-join>
+
+Whether to compute the differences with a single query when both tables can
+be reached from one connection, instead of building checksum and summary
+tables on each side and merging them from the client.
+For SQLite, both database files are attached to a separate in-memory
+connection and merged in one pass with the C<PGC_DIFF> aggregate provided by
+C<sqlite_checksum.so>, so that nothing is written to the compared files.
+For PostgreSQL, tables in the same base are compared by the first connection
+with a full outer join on the keys, which is hashed or merged by the server,
+or with a grouping of both tables if some key may be null.
+For MySQL, tables on the same server, possibly in different bases,
+are compared by grouping both tables on their keys.
+Tuple checksums are computed on the fly, and the keys of differing tuples are
+fed directly to the report and synchronization.
+Both tables are also counted, and the comparison fails if there are more
+differences than allowed by the default C<--max-ratio>, or by C<--max-ratio>
+or C<--max-report> when the join is requested explicitly.
+
+Default is to join when possible, that is when both connections are SQLite
+databases, or when both tables are in the same PostgreSQL base or on the same
+MySQL server with the same login, in any case without C<--lock> nor
+C<--source-*> overrides, and without any option which only applies to the
+checksum tree algorithm: C<--folding-factor>, C<--max-ratio>,
+C<--max-report>, C<--max-levels>, C<--threads>, C<--iblt>, C<--slim>,
+C<--key-checksum-size> other than 4, or C<--column-groups> when only
+comparing.
+Table locks are taken by each connection, so that the first one could not
+read the table locked by the second one, thus the joined comparison is not
+chosen by default when synchronizing, unless C<--no-lock> is also specified.
+
 =item C<--key-checksum='kcs'> or C<--kcs=...>
 
 Use key checksum attribute of this name, which must be already available in
@@ -166,6 +267,39 @@ integer primary key.
 
 Default is to build both key and tuple checksums on the fly.
 
+=item C<--key-checksum-size=n> or C<--kcs-size=n>
+
+Key checksum size, must be B<4> or B<8> bytes.
+The key checksum is used to group tuples into the summary tables with masks
+derived from the table size, thus a 4 bytes key checksum cannot split
+more than 2**32 tuples, and its collisions become frequent at level 0 above
+a few hundred million tuples, which requires more key comparisons.
+An 8 bytes key checksum uses 64-bit integers for the checksum table and
+summary tables key checksums, so that buckets stay balanced on huge tables.
+When provided with C<--key-checksum>, the attribute must be of this size.
+
+Under C<--use-key>, the key itself replaces the key checksum in the checksum
+table, and this size only applies to the key checksums of summary tables.
+
+Default is B<4>, which is enough for tables up to about a hundred million
+tuples.
+
+=item C<--key-ranges>, C<--no-key-ranges>
+
+Whether to compare contiguous ranges of a scalar integer key instead of
+key checksum buckets. No checksum nor summary tables are built: the count
+and aggregated tuple checksum of each range are computed directly from the
+base tables, so that an index on the key allows to read only this range.
+Differing ranges are split on quantiles of the key taken on the side with
+more tuples, into about 2**C<--folding-factor> sub-ranges, the boundaries of
+which are used on both sides. Ranges with few tuples are compared tuple per
+tuple. This requires window functions, thus PostgreSQL 8.4, MySQL 8.0,
+MariaDB 10.2 or SQLite 3.25 at least, which is checked beforehand.
+Tables which are mostly appended to, where differences are clustered at
+the end of the key range, are compared efficiently this way.
+
+Default is to use key checksum buckets.
+
 =item C<--lock>, C<--no-lock>
 
 Whether to lock tables.
@@ -174,7 +308,8 @@ For PostgreSQL, this option requires C<--transaction>, which is enabled by
 default.
 
 Default depends on the current operation: the table is I<not locked> for a
-comparison, but it is I<locked> for a synchronization.
+comparison, but it is I<locked> for a synchronization, unless C<--sync-jobs>
+is greater than 1 or C<--snapshot> is used.
 
 =item C<--long-read-len=0> or C<-L 0>
 
@@ -251,6 +386,41 @@ Report differing keys to stdout as they are found.
 
 Default is to report.
 
+=item C<--sample=ratio>
+
+Quick check of a pseudo-random subset of the tables, for instance B<0.01>
+to look at about one percent of the tuples.
+A contiguous range of key checksum values, the start of which depends on
+C<--sample-seed>, is selected with a C<BETWEEN> condition on both sides,
+so that the same tuples are considered.
+The range is taken within non-negative values, thus ratios above B<0.5>
+compare the whole tables.
+Under C<--use-key>, the range is a contiguous range of the key values
+instead, the bounds of which are read from both tables.
+Both sides only return per group counts and tuple checksum aggregates for
+at most 1024 groups of sampled tuples, which are compared by the client.
+No checksum or summary tables are created.
+The range condition can only be served by an index when the key checksum
+is a provided attribute with C<--key-checksum>, or by the primary key under
+C<--use-key>. Otherwise the key checksum is computed during a full scan of
+both tables, so that the cost of the check is only reduced for the client.
+
+When no difference is found, an upper bound on the number of differing
+tuples with 95% confidence is reported, assuming that the differing tuples
+are evenly distributed among key checksums.
+Otherwise the number of differing groups is counted as the number of
+differences, unless C<--escalate> is set.
+This option cannot be used with C<--synchronize> without C<--escalate>.
+
+Default is to compare the whole tables.
+
+=item C<--sample-seed=n>
+
+Seed used to choose the sampled buckets under C<--sample>.
+
+Default is to use a new seed on each run, so that successive runs check
+distinct parts of the tables. The seed is shown with C<--verbose>.
+
 =item C<--separator='|'> or C<-s '|'>
 
 Separator string or character used when concatenating key columns for
@@ -266,6 +436,42 @@ size.
 
 Default is to query the table sizes, which is skipped if this option is set.
 
+=item C<--slim>, C<--no-slim>
+
+Whether to keep a row locator instead of a copy of the key attributes in the
+checksum table, that is the C<tableoid> and C<ctid> for PostgreSQL, so that
+partitioned and inherited tables are supported, and the C<rowid> for SQLite. This reduces the size of the checksum table with wide or composite
+keys, and the keys are fetched from the base table through the locator only
+for the tuples in differing level 0 buckets.
+The locators must not change during the comparison, so the tables should
+not be updated concurrently, see C<--lock>.
+This option is ignored under C<--use-key> or C<--tuple-checksum>,
+or with other databases which do not provide a row locator, such as MySQL.
+SQLite tables created C<WITHOUT ROWID> cannot be compared this way.
+
+Default is to keep keys in the checksum table.
+
+=item C<--snapshot>, C<--snapshot=id>
+
+Compare tables within consistent snapshot transactions instead of locking
+them, so that concurrent writes are not blocked.
+With PostgreSQL, the transaction is C<REPEATABLE READ>, and the snapshot of
+the first connection is exported to the second one if both tables are in the
+same base, so that they are seen at the same instant.
+The snapshot of another session, as returned by C<pg_export_snapshot()>, may
+be imported by giving its identifier.
+With MySQL, a consistent snapshot transaction is started, which only applies
+to transactional engines such as InnoDB, and temporary tables are required.
+The identifier is not available with MySQL, and snapshots do not work
+with C<--threads>.
+When synchronizing, only the rows of the second table to be updated or
+deleted are locked with C<SELECT ... FOR UPDATE> just before they are
+changed.
+With PostgreSQL, the synchronization then fails if any of these rows was
+changed after the snapshot, and must be run again.
+
+Default is not to use snapshots.
+
 =item C<--source-1='DBI:...'>, C<--source-2='...'> or C<-1 '...'>, C<-2 '...'>
 
 Take full control of DBI data source specification and mostly ignore
@@ -302,6 +508,26 @@ C<--do-it> or C<-D>. Save your data before attempting anything like that!
 
 Default is not to synchronize.
 
+=item C<--sync-jobs=n>
+
+Apply the synchronization to the second table through C<n> connections,
+each handling the keys of one shard, with batched statements which are
+run concurrently thanks to asynchronous queries.
+All deletes are done first, then updates, then inserts. The values of the
+updates are fetched by batches for all connections at once, and each
+connection then runs one update at a time. Keys are matched with NULL-safe
+conditions, and the first failing statement rolls back all shards.
+The second table must not have unique indexes other than the key, which
+could make connections wait on each other, and asynchronous queries are
+required.
+All shards are committed together with a two-phase commit, so that the
+second table is either fully synchronized or not changed at all.
+This requires a PostgreSQL or MySQL second table, and PostgreSQL must allow
+prepared transactions with a positive C<max_prepared_transactions>.
+Tables are not locked by default, and option C<--pg-copy> is ignored.
+
+Default is 1, that is to synchronize through the comparison connection.
+
 =item C<--temporary>, C<--no-temporary>
 
 Whether to use temporary tables. If you don't, the tables are kept by default
@@ -602,6 +828,10 @@ where C<...> are the connection options:
 
   sh> psql ... -c 'CREATE EXTENSION pgcmp' DB
 
+To upgrade an already loaded extension to the installed version:
+
+  sh> psql ... -c 'ALTER EXTENSION pgcmp UPDATE' DB
+
 To uninstall:
 
   sh> psql ... -c 'DROP EXTENSION pgcmp' DB
@@ -724,7 +954,8 @@ C<threads> for the experimental threaded version with option C<--threads>.
 
 =item
 
-C<Digest::MD5> for md5 checksum with SQLite.
+C<Digest::MD5> for md5 checksum with SQLite if C<sqlite_checksum.so> is not
+loaded.
 
 =back
 
@@ -971,6 +1202,9 @@ is summarized by the following query:
            OR T2.id IS NULL      -- INSERT
            OR T1.data <> T2.data -- UPDATE
 
+This is basically what the C<--join> option does on the tuple checksums,
+which is chosen by default when possible.
+
 =head2 REFERENCES
 
 A paper was presented at a conference about this tool and its algorithm:
@@ -1211,6 +1445,30 @@ L<github repos|https://github.com/zx80/pg_comparator>.
 =item B<version @VERSION@> (r@REVISION@ on @DATE@)
 
 In development.
+Add C<--join> option to compare two SQLite files in one pass on a single
+connection, with a new C<PGC_DIFF> merge aggregate.
+Use a single join query by default to compare tables on the same
+PostgreSQL base or MySQL server.
+Add C<--key-checksum-size> option to allow 8 bytes key checksums and masks
+for huge tables.
+Add C<--sample> quick check option on a pseudo-random subset of key checksum
+buckets, with optional C<--escalate> to the full comparison.
+Add C<--column-groups> option to only update differing groups of columns
+when synchronizing.
+Add C<--key-ranges> option to compare contiguous key ranges read from the
+base tables instead of key checksum buckets.
+Add C<--slim> option to keep a row locator instead of the key in the
+checksum table.
+Add C<--iblt> option to find a few differences in two rounds from invertible
+Bloom lookup table sketches, with a new C<IBLT> aggregate.
+Add C<--export-tree> and C<--import-tree> options to save the checksum
+tree of a table to a file and compare other tables against it later.
+Add native C<md5_2>, C<md5_4> and C<md5_8> checksum functions, which also
+allow md5 checksums in mixed SQLite mode.
+Add C<--sync-jobs> option to synchronize through several connections with
+sharded batches and a two-phase commit.
+Add C<--snapshot> option to compare within consistent snapshots instead of
+locking tables, with PostgreSQL snapshots shared between connections.
 
 =item B<version 2.3.2> (r1594 on 2020-11-03)
 
@@ -1537,20 +1795,35 @@ $revision =~ tr/0-9//cd;
 
 # various option defaults
 my ($verb, $debug, $temp, $unlog, $ask_pass, $clear) = (0, 0, 1, 0, 0, 0);
-my ($max_ratio, $max_levels, $report, $threads, $async) =  (0.1, 0, 1, 0, 1);
+# tree algorithm parameters are set later, see $tree_options
+my ($max_ratio, $max_levels, $report, $threads, $async) =
+  (undef, undef, 1, 0, 1);
 my ($cleanup, $size, $usekey, $usenull, $synchronize) = (0, 0, 0, 1, 0);
 my ($do_it, $do_trans, $prefix, $ckcmp) = (0, 1, 'pgc_cmp', 'create');
 my ($maskleft, $name, $key_size, $col_size, $where) = (1, 'none', 0, 0, '');
-my ($factor, $expect_warn) = (7, 0);
+my ($factor, $expect_warn) = (undef, 0);
 my ($skip_inserts, $skip_updates, $skip_deletes) = (0, 0, 0);
 # condition, tests, max size of blobs, data sources...
 my ($expect, $longreadlen, $source1, $source2, $key_cs, $tup_cs, $do_lock,
-    $env_pass, $max_report, $stats, $pg_copy, $pg_text_cast);
+    $env_pass, $max_report, $stats, $pg_copy, $pg_text_cast, $do_join);
 
 # algorithm defaults
 # hmmm... could rely on base64 to handle binary keys?
 # the textual representation cannot be trusted to avoid the separator
 my ($null, $checksum, $checksize, $agg, $sep) = ('text', 'ck', 8, 'sum', '|');
+my $kcs_size = 4;
+# number of column groups, 0 for none
+my ($col_groups, $key_ranges, $slim) = (0, 0, 0);
+# sampling ratio, seed and escalation to the full algorithm
+my ($sample, $sample_seed, $escalate) = (undef, undef, 0);
+# expected number of differences for the sketch, 0 for none
+my $iblt = 0;
+# number of target connections for synchronizing, and keys per statement
+my ($sync_jobs, $sync_batch) = (1, 128);
+# snapshot identifier to import, '' to take a new one
+my $snapshot;
+# reference tree files, and the imported tree which replaces side 1
+my ($export_tree, $import_tree, $tree1);
 
 ######################################################################### UTILS
 
@@ -1609,8 +1882,7 @@ sub pgsql_cksum_template($$) {
   my ($algo, $sz) = @_;
   return "CKSUM$sz((%s)::TEXT)" if $algo eq 'ck';
   return "FNV$sz((%s)::TEXT)" if $algo eq 'fnv';
-  return pgsql_cast("DECODE(MD5(%s::TEXT),'hex')::BIT(" . 8*$sz . ")", $sz)
-    if $algo eq 'md5';
+  return "MD5_$sz((%s)::TEXT)" if $algo eq 'md5';
   die "unexpected checksum $algo for pgsql";
 }
 
@@ -1618,8 +1890,7 @@ sub mysql_cksum_template($$) {
   my ($algo, $sz) = @_;
   return "CKSUM$sz(CAST(%s AS BINARY))" if $algo eq 'ck';
   return "FNV$sz(CAST(%s AS BINARY))" if $algo eq 'fnv';
-  return mysql_cast("CONV(LEFT(MD5(%s),". 2*$sz ."),16,10)", $sz)
-    if $algo eq 'md5';
+  return "MD5_$sz(CAST(%s AS BINARY))" if $algo eq 'md5';
   die "unexpected checksum $algo for mysql";
 }
 
@@ -1627,7 +1898,7 @@ sub sqlite_cksum_template($$) {
   my ($algo, $sz) = @_;
   return "CKSUM$sz(CAST(%s AS TEXT))" if $algo eq 'ck';
   return "FNV$sz(CAST(%s AS TEXT))" if $algo eq 'fnv';
-  return "PGC_MD5($sz, CAST(%s AS TEXT))" if $algo eq 'md5';
+  return "MD5_$sz(CAST(%s AS TEXT))" if $algo eq 'md5';
   die "unexpected checksum $algo for sqlite";
 }
 
@@ -1764,6 +2035,21 @@ sub sqlite_initialize($)
   # database locking with begin transaction
   # note: there must be two databases, otherwise this is a dead lock!
   $dbh->{sqlite_use_immediate_transaction} = 1 if $do_lock;
+  if ($checksum eq 'md5') {
+    # perl fallback, replaced by the extension functions if loaded below
+    require Digest::MD5;
+    for my $sz (2, 4, 8) {
+      # first bytes of the digest as a big-endian signed integer
+      my $fmt = $sz==2? 's>': $sz==4? 'l>': 'q>';
+      $dbh->sqlite_create_function("MD5_$sz", 1,
+        sub {
+          my ($data) = @_;
+          return 0 unless defined $data;
+          utf8::encode($data) if utf8::is_utf8($data);
+          return unpack($fmt, Digest::MD5::md5($data));
+        });
+    }
+  }
   # load checksum and possiby other extensions
   if (exists $ENV{PGC_SQLITE_LOAD_EXTENSION}) {
     $dbh->sqlite_enable_load_extension(1);
@@ -1771,16 +2057,6 @@ sub sqlite_initialize($)
       sql_do($dbh, 'sqlite', "SELECT load_extension('$extension');");
     }
   }
-  if ($checksum eq 'md5') {
-    # use perl own implementation!
-    require Digest::MD5;
-    $dbh->sqlite_create_function("PGC_MD5", 2,
-      sub {
-        my ($bytes, $data) = @_;
-        my $fmt = $bytes==2? 'x14s': $bytes==4? 'x12l': 'x8q';
-        return unpack($fmt, Digest::MD5::md5($data));
-      });
-  }
 }
 
 sub firebird_initialize($)
@@ -1800,9 +2076,36 @@ sub mysql_lock($$) { # for mysql... locks are seen as a weak transaction tool
   my ($t, $ro) = @_; return "LOCK TABLES $t " . ($ro? 'READ': 'WRITE');
 }
 
+# start a repeatable read transaction, possibly on an imported snapshot
+sub pgsql_snapshot($$) {
+  my ($dbh, $id) = @_;
+  sql_do($dbh, 'pgsql', 'SET TRANSACTION ISOLATION LEVEL REPEATABLE READ');
+  sql_do($dbh, 'pgsql', "SET TRANSACTION SNAPSHOT " . $dbh->quote($id))
+    if defined $id and $id ne '';
+}
+
+# the snapshot is taken when the transaction starts, for innodb tables
+sub mysql_snapshot($$) {
+  my ($dbh, $id) = @_;
+  sql_do($dbh, 'mysql', 'SET TRANSACTION ISOLATION LEVEL REPEATABLE READ');
+  sql_do($dbh, 'mysql', 'START TRANSACTION WITH CONSISTENT SNAPSHOT');
+}
+
 sub quote_tuple($@) {
   my ($dbh, @values) = @_;
-  return '(' . (join ',', map { $dbh->quote($_) } @_) . ')';
+  return '(' . (join ',', map { $dbh->quote($_) } @values) . ')';
+}
+
+# null-safe condition matching any of the key tuples, with quoted values
+sub tuples_equal($$@) {
+  my ($dbh, $cols, @keys) = @_;
+  return '(' . join(' OR ', map {
+      my $key = $_;
+      '(' . join(' AND ', map {
+          defined $$key[$_]? "$$cols[$_]=" . $dbh->quote($$key[$_]):
+            "$$cols[$_] IS NULL"
+        } 0 .. @$cols-1) . ')'
+    } @keys) . ')';
 }
 
 # define all database specific "attributes" and "methods"
@@ -1867,11 +2170,7 @@ my %M = (
     },
     # sql checksum for one attribute: cksum{$algo}($size, $att)
     'ckoneatt' => {
-      'md5' => sub { my ($sz, $att) = @_;
-        return pgsql_cast(
-          "COALESCE(DECODE(MD5(${att}::TEXT),'hex'),''::BYTEA)" .
-          "::BIT(" .  8*$sz . ")", $sz);
-        },
+      'md5' => sub { my ($sz, $att) = @_; return "MD5_$sz(${att}::TEXT)"; },
       'ck' => sub { my ($sz, $att) = @_; return "CKSUM$sz(${att}::TEXT)"; },
       'fnv' => sub { my ($sz, $att) = @_; return "FNV$sz(${att}::TEXT)"; }
     },
@@ -1886,6 +2185,19 @@ my %M = (
     # 'initialize' database handler: initialize($dbh)
     # bitwise and operation: andop($s1,$s2)
     'andop' => \&amp_and,
+    # single query differences: join($dbh, $dhpbt, $tab1, $key1, $tcs1, ...)
+    'join' => \&pgsql_join,
+    # row locator attributes and types, the ctid is only unique within
+    # one relation of a partitioned or inherited table
+    'locator' => [['tableoid', 'OID'], ['ctid', 'TID']],
+    # two-phase commit statements, the transaction is started with begin_work
+    'xa' => { 'prepare' => "PREPARE TRANSACTION '%s'",
+              'commit' => "COMMIT PREPARED '%s'",
+              'rollback' => "ROLLBACK PREPARED '%s'" },
+    # consistent snapshot transaction: snapshot($dbh, $id)
+    'snapshot' => \&pgsql_snapshot,
+    # query to share the current snapshot with other connections
+    'export_snapshot' => 'SELECT pg_export_snapshot()',
   },
   #
   # MySQL
@@ -1923,9 +2235,8 @@ my %M = (
     },
     'ckoneatt' => {
       'md5' => sub { my ($sz, $att) = @_;
-        return mysql_cast(
-          "COALESCE(CONV(LEFT(MD5($att),". 2*$sz ."),16,10),0)", $sz);
-        },
+        return "MD5_$sz(CAST($att AS BINARY))"
+      },
       'ck' => sub { my ($sz, $att) = @_;
         return "CKSUM$sz(CAST($att AS BINARY))"
       },
@@ -1939,6 +2250,11 @@ my %M = (
     'get_result' => \&mysql_get_result,
     # no 'initialize'
     'andop' => \&amp_and,
+    'join' => \&group_join,
+    'xa' => { 'start' => "XA START '%s'", 'end' => "XA END '%s'",
+              'prepare' => "XA PREPARE '%s'", 'commit' => "XA COMMIT '%s'",
+              'rollback' => "XA ROLLBACK '%s'" },
+    'snapshot' => \&mysql_snapshot,
   },
   #
   # SQLite
@@ -1976,7 +2292,7 @@ my %M = (
     },
     'ckoneatt' => {
       'md5' => sub { my ($sz, $att) = @_;
-        return "PGC_MD5($sz, CAST($att AS TEXT))";
+        return "MD5_$sz(CAST($att AS TEXT))";
         },
       'ck' => sub { my ($sz, $att) = @_;
         return "CKSUM$sz(CAST($att AS TEXT))";
@@ -1991,6 +2307,9 @@ my %M = (
     # no 'get_result'
     'initialize' => \&sqlite_initialize,
     'andop' => \&amp_and,
+    # single query differences: join($dbh, $dhpbt, $tab1, $key1, $tcs1, ...)
+    'join' => \&sqlite_join,
+    'locator' => [['rowid', 'INTEGER']],
   },
   #
   # Firebird: this is a strange bird...
@@ -2304,6 +2623,8 @@ sub conn($$$$$$$$$)
   if ($do_trans) {
     # start a big transaction...
     $dbh->begin_work or die $dbh->errstr;
+    # ... on a consistent snapshot
+    &{$M{$db}{snapshot}}($dbh, $snapshot) if defined $snapshot;
   }
 
   # handle explicit table locking
@@ -2381,6 +2702,27 @@ sub get_table_pkey($$$$)
   return @keys;
 }
 
+# get the columns of each unique index, including the primary key.
+# expression columns are shown as '?'.
+sub get_table_unique_keys($$$$)
+{
+  my ($dbh, $db, $base, $table) = @_;
+  dbh_materialize($dbh, $db);
+  $query_meta++;
+  async_wait($dbh, $db, 'unique') if $async;
+  my $sth =
+    $dbh->statistics_info($base, &{$M{$db}{tableid}}($table), 1, 1);
+  die "statistics_info not implemented by driver" unless defined $sth;
+  my %index;
+  while (my $h = $sth->fetchrow_hashref()) {
+    next unless defined $$h{INDEX_NAME};
+    $index{$$h{INDEX_NAME}}[$$h{ORDINAL_POSITION}-1] =
+      defined $$h{COLUMN_NAME}? $$h{COLUMN_NAME}: '?';
+  }
+  dbh_serialize($dbh, $db);
+  return values %index;
+}
+
 # wrap column_info with a cache
 # dhpbt is db:host:port:base:table
 my %column_info = ();
@@ -2540,6 +2882,71 @@ sub key_pk_get($$$$$)
   return $res;
 }
 
+# split a list of columns into at most $col_groups consecutive groups
+sub split_groups($)
+{
+  my ($cols) = @_;
+  my $n = $col_groups < @$cols? $col_groups: @$cols;
+  my @groups = map { [] } 1 .. $n;
+  for my $i (0 .. @$cols-1) {
+    push @{$groups[int($i * $n / @$cols)]}, $$cols[$i];
+  }
+  return @groups;
+}
+
+# condition on the keys kept in the checksum table
+sub cs_key_equal($$$$)
+{
+  my ($dbh, $dhpbt, $db, $keys) = @_;
+  return 'kcs=?' if $usekey;
+  my @expr;
+  for my $i (0 .. @$keys-1) {
+    push @expr, "pk$i" . (col_is_not_null($dbh, $dhpbt, $$keys[$i])?
+                          '=?': $M{$db}{safeeq});
+  }
+  return join ' AND ', @expr;
+}
+
+# string to look up a key fetched from the database
+sub key_string(@)
+{
+  return join $sep, map { defined $_? "=$_": 'NULL' } @_;
+}
+
+# group checksums of a list of keys from a checksum table, by key string
+# gcs_fetch($dbh, $dhpbt, $db, $name, $keys, $ngroups, @tuples)
+sub gcs_fetch($$$$$$@)
+{
+  my ($dbh, $dhpbt, $db, $name, $keys, $ngroups, @tuples) = @_;
+  my @kl = $usekey? ('kcs'): map { "pk$_" } 0 .. @$keys-1;
+  my $cond = '(' . cs_key_equal($dbh, $dhpbt, $db, $keys) . ')';
+  my $query = "SELECT " . join(', ', @kl, map { "gcs$_" } 0 .. $ngroups-1) .
+    " FROM ${name}0 WHERE " . join(' OR ', ($cond) x @tuples);
+  $query_nb++;
+  $query_sz += length($query);
+  verb 3, "$query_nb\t$query";
+  my $sth = $dbh->prepare($query);
+  $sth->execute(map { @$_ } @tuples);
+  my %gcs;
+  while (my @row = $sth->fetchrow_array()) {
+    my @key = splice @row, 0, scalar @kl;
+    $gcs{key_string(@key)} = [@row];
+  }
+  &{$M{$db}{close_cursor}}($sth) if exists $M{$db}{close_cursor};
+  return \%gcs;
+}
+
+# group checksums of key $u from a batch, or from its own query if its
+# representation differs between the fetched and the batch keys
+sub gcs_lookup($$$$$$$$)
+{
+  my ($gcs, $dbh, $dhpbt, $db, $name, $keys, $ngroups, $u) = @_;
+  my $found = $$gcs{key_string(@$u)};
+  ($found) = values %{gcs_fetch($dbh, $dhpbt, $db, $name, $keys, $ngroups,
+                                $u)} unless $found;
+  return $found? @$found: ();
+}
+
 # build initial checksum table, dbh must be serialized
 # NOTE: if 'insert' the number of rows is returned or underway
 # keys: list of key attributes
@@ -2550,20 +2957,40 @@ sub build_cs_table($$$$$$$$)
   verb 2, "building checksum table ${name}0";
   sql_do($dbh, $db, "$M{$db}{drop_table} ${name}0") if $cleanup;
 
+  # optional COLUMN GROUP CHECKSUMS
+  my ($gcs, $gdecl, $glist, $g) = ('', '', '', 0);
+  # KEY or LOCATOR, only if needed
+  my @loc = $slim? @{$M{$db}{locator}}: ();
+  my ($kept, $kdecl, $klist) =
+    $usekey? ('', '', ''):
+    $slim? (join('', map { ", $loc[$_][0] AS loc$_" } 0 .. $#loc),
+            join('', map { ", loc$_ $loc[$_][1]" } 0 .. $#loc),
+            join('', map { ", loc$_" } 0 .. $#loc)):
+    (', ' . key_pk_get($dbh, $dhpbt, $db, $keys, 'AS'),
+     ', ' . key_pk_get($dbh, $dhpbt, $db, $keys, 'DECL'),
+     ', ' . key_pk_get($dbh, $dhpbt, $db, $keys, 'LIST'));
+  # group checksums are only used to synchronize
+  for my $group ($col_groups && $synchronize? split_groups($cols): ()) {
+    $gcs .= ', ' . ckatts($db, $checksum, $checksize, $group) . " AS gcs$g";
+    $gdecl .= ", gcs$g $M{$db}{cktype}{$checksize} NOT NULL";
+    $glist .= ", gcs$g";
+    $g++;
+  }
+
   # CREATE AS vs INSERT SELECT to get row count & choose types.
   my $build_checksum =
     "SELECT " .
     # KEY CHECKSUM
     # ??? hmmm... should rather use quote_nullable()? then how to unquote?
-    # always use 4 bytes for hash(key), because mask is 4 bytes anyway.
+    # hash(key) size is chosen to match the masks, 4 bytes by default.
     # however under usekey the key type is kept as such
-    ($usekey? "@$keys": ckatts($db, $checksum, 4, $pkeys)) . " AS kcs, " .
+    ($usekey? "@$keys": ckatts($db, $checksum, $kcs_size, $pkeys)) .
+    " AS kcs, " .
     # then TUPLE CHECKSUM
     # this could be skipped if cols is empty...
     # it would be somehow redundant with the previous one if same size
     ckatts($db, $checksum, $checksize, [@$pkeys, @$cols]) . " AS tcs" .
-    # keep KEY, only if needed
-    ($usekey? '': ', ' . key_pk_get($dbh, $dhpbt, $db, $keys, 'AS')) .
+    $gcs . $kept .
     " FROM $table" . ($where? " WHERE $where": '');
 
   # ??? What about using quoted strings or using an array for values?
@@ -2589,16 +3016,15 @@ sub build_cs_table($$$$$$$$)
            "TABLE ${name}0 (".
            # KEY CHECKSUM NN?
            'kcs ' .
-       ($usekey? col_type($dbh, $dhpbt, $db, "@$pkeys"): $M{$db}{cktype}{4}) .
+       ($usekey? col_type($dbh, $dhpbt, $db, "@$pkeys"):
+                 $M{$db}{cktype}{$kcs_size}) .
            # TUPLE CHECKSUM NN?
            ' NOT NULL, tcs ' . $M{$db}{cktype}{$checksize} . ' NOT NULL' .
-           # KEY...
-           ($usekey? '': ', ' . key_pk_get($dbh, $dhpbt, $db, $keys, 'DECL')) .
+           $gdecl . $kdecl .
            ");");
     $count =
-      sql_do($dbh, $db, "INSERT INTO ${name}0(kcs, tcs" .
-            ($usekey? '': ', ' . key_pk_get($dbh, $dhpbt, $db, $keys, 'LIST')) .
-             ") ". $build_checksum);
+      sql_do($dbh, $db, "INSERT INTO ${name}0(kcs, tcs$glist$klist) " .
+             $build_checksum);
   }
   else {
     die "unexpect checksum computation variant: $ckcmp";
@@ -2692,7 +3118,7 @@ sub compute_summary($$$$$$@)
   }
   else { # create + insert
     sql_do($dbh, $db,
-           "$create_table(kcs $M{$db}{cktype}{4}, " .
+           "$create_table(kcs $M{$db}{cktype}{$kcs_size}, " .
                          "tcs $M{$db}{cktype}{$checksize})");
     sql_do($dbh, $db, "INSERT INTO ${name}${level}(kcs,tcs) $select");
   }
@@ -2718,23 +3144,33 @@ sub selkcs($$$$$@)
 {
   my ($dbh, $db, $table, $skey, $level, $mask, $get_key, @kcs) = @_;
   my ($kcs, $tcs) = ('kcs', 'tcs');
+  # whether keys are read from the base table
+  my $base_key = defined $tup_cs;
   if (defined $tup_cs and $level==0)
   {
     $tcs = $tup_cs;
     $kcs = $key_cs if defined $key_cs;
     $kcs = "@$skey" if $usekey;
   }
+  if ($slim and $level==0)
+  {
+    # table is the slim checksum table joined to the base table
+    ($kcs, $tcs, $base_key) = ('pgc_c.kcs', 'pgc_c.tcs', 1);
+    $skey = [map { "pgc_t.$_" } @$skey];
+  }
   my $query =
       "SELECT $kcs AS kcs, $tcs AS tcs" .
         # if kcs==pk, do not transfer the key
         (($get_key and not $usekey)?
-         ', ' . key_pk_get(0, 0, $db, $skey, $tup_cs? 'AS': 'LIST'): '') .
+         ', ' . key_pk_get(0, 0, $db, $skey, $base_key? 'AS': 'LIST'): '') .
       " FROM $table ";
   # the "& mask" is really a modulo operation
   $query .= "WHERE " . &{$M{$db}{andop}}($kcs, $mask) .
                    " IN (" . join(',', @kcs) . ') ' if @kcs;
-  $query .= "ORDER BY $kcs";
-  $query .= ', ' . key_pk_get(0, 0, $db, $skey, $tup_cs? 'CASTATT': 'CAST')
+  # without a kcs list, a mask groups the rows by bucket first
+  $query .= "ORDER BY " .
+    (($mask and not @kcs)? &{$M{$db}{andop}}($kcs, $mask) . ', ': '') . $kcs;
+  $query .= ', ' . key_pk_get(0, 0, $db, $skey, $base_key? 'CASTATT': 'CAST')
     if $get_key and not $usekey;
   # keep trac of running query
   verb 3, "$query_nb\t$query";
@@ -2746,6 +3182,30 @@ sub selkcs($$$$$@)
   return $sth;
 }
 
+# checksum table joined to the base table through the row locator
+sub slim_join($$$)
+{
+  my ($db, $cstable, $table) = @_;
+  my @loc = @{$M{$db}{locator}};
+  return "$cstable AS pgc_c JOIN $table AS pgc_t ON " .
+    join(' AND ', map { "pgc_t.$loc[$_][0] = pgc_c.loc$_" } 0 .. $#loc);
+}
+
+# ($table, $kcs_att, $key_att) for get_bulk_keys
+# globals: $tup_cs $key_cs $usekey $slim
+sub bulk_atts($$$$)
+{
+  my ($db, $name, $table, $keys) = @_;
+  my $kcs = defined $key_cs? $key_cs: ($usekey and $tup_cs)? "@$keys": 'kcs';
+  return ($table, $kcs, key_pk_get(0, 0, $db, $keys, 'AS'))
+    if defined $tup_cs;
+  return (slim_join($db, "${name}0", $table), "pgc_c.$kcs",
+          key_pk_get(0, 0, $db, [map { "pgc_t.$_" } @$keys], 'AS'))
+    if $slim;
+  return ("${name}0", $kcs,
+          $usekey? 'kcs': key_pk_get(0, 0, $db, $keys, 'LIST'));
+}
+
 # investigate an "kcs/mask" list to show corresponding keys.
 # get_bulk_keys($dbh, $table, $nature, @kcs_masks)
 # globals: $verb $report
@@ -2786,6 +3246,786 @@ sub get_bulk_keys($$$$$@)
   return \@keys;
 }
 
+# build a connection with both SQLite bases attached as pgc_1 and pgc_2
+# the main base is in memory, so the compared files are only read.
+sub sqlite_attach($$)
+{
+  my ($b1, $b2) = @_;
+  verb 3, "attaching $b1 and $b2";
+  my $dbh = DBI->connect('DBI:SQLite:dbname=:memory:', '', '',
+                { RaiseError => 1, PrintError => 0, AutoCommit => 1 })
+      or die $DBI::errstr;
+  # load checksum and merge extensions
+  sqlite_initialize($dbh);
+  sql_do($dbh, 'sqlite', 'ATTACH DATABASE ' . $dbh->quote($b1) . ' AS pgc_1');
+  sql_do($dbh, 'sqlite', 'ATTACH DATABASE ' . $dbh->quote($b2) . ' AS pgc_2');
+  return $dbh;
+}
+
+# detach both bases and close the connection, even on errors
+sub sqlite_detach($)
+{
+  my ($dbh) = @_;
+  for my $base ('pgc_1', 'pgc_2') {
+    eval { sql_do($dbh, 'sqlite', "DETACH DATABASE $base"); };
+    warn "cannot detach $base: $@" if $@;
+  }
+  $dbh->disconnect();
+}
+
+# quoted name of a table in an attached base, its schema is the base
+sub sqlite_attached($$)
+{
+  my ($base, $table) = @_;
+  $table =~ s/^(\"([^\"]|\"\")*\"|[^\".]*)\.//;
+  my $name = dq_unquote($table);
+  $name =~ s/\"/\"\"/g;
+  return "$base.\"$name\"";
+}
+
+# query for (operation, key...) of differing tuples in one pass:
+# both sides are grouped per key and merged by the PGC_DIFF aggregate.
+sub sqlite_join($$$$$$$$)
+{
+  my ($dbh, $dhpbt, $t1, $k1, $tcs1, $t2, $k2, $tcs2) = @_;
+  my $cond = $where? " WHERE $where": '';
+  return
+    "SELECT PGC_DIFF(side, tcs) AS op, " .
+      key_pk_get(0, 0, 'sqlite', $k1, 'LIST') . " " .
+    "FROM (" .
+      "SELECT 1 AS side, $tcs1 AS tcs, " .
+        key_pk_get(0, 0, 'sqlite', $k1, 'AS') . " FROM $t1$cond " .
+      "UNION ALL " .
+      "SELECT 2 AS side, $tcs2 AS tcs, " .
+        key_pk_get(0, 0, 'sqlite', $k2, 'AS') . " FROM $t2$cond) " .
+    "GROUP BY " . key_pk_get(0, 0, 'sqlite', $k1, 'LIST') . " " .
+    "HAVING op IS NOT NULL";
+}
+
+# same, with standard aggregates: a key is different unless it appears
+# exactly once on each side with the same tuple checksum.
+sub group_join($$$$$$$$)
+{
+  my ($dbh, $dhpbt, $t1, $k1, $tcs1, $t2, $k2, $tcs2) = @_;
+  my ($db) = split /:/, $dhpbt;
+  my $cond = $where? " WHERE $where": '';
+  my $keys = key_pk_get(0, 0, $db, $k1, 'LIST');
+  return
+    "SELECT CASE WHEN MIN(side)=2 THEN 'DELETE' " .
+      "WHEN MAX(side)=1 THEN 'INSERT' ELSE 'UPDATE' END AS op, $keys " .
+    "FROM (" .
+      "SELECT 1 AS side, $tcs1 AS tcs, " .
+        key_pk_get(0, 0, $db, $k1, 'AS') . " FROM $t1$cond " .
+      "UNION ALL " .
+      "SELECT 2 AS side, $tcs2 AS tcs, " .
+        key_pk_get(0, 0, $db, $k2, 'AS') . " FROM $t2$cond) AS pgc_u " .
+    "GROUP BY $keys " .
+    "HAVING MIN(side)=MAX(side) OR COUNT(*)<>2 OR MIN(tcs)<>MAX(tcs)";
+}
+
+# same with a full outer join on the keys, which can be hashed or merged
+# by postgresql as long as keys are not null.
+sub pgsql_join($$$$$$$$)
+{
+  my ($dbh, $dhpbt, $t1, $k1, $tcs1, $t2, $k2, $tcs2) = @_;
+  for my $k (@$k1) {
+    # FULL JOIN requires merge or hash joinable conditions
+    return group_join($dbh, $dhpbt, $t1, $k1, $tcs1, $t2, $k2, $tcs2)
+      unless col_is_not_null($dbh, $dhpbt, $k);
+  }
+  my $cond = $where? " WHERE $where": '';
+  my (@on, @keys);
+  for my $i (0 .. @$k1-1) {
+    push @on, "c1.pk$i=c2.pk$i";
+    push @keys, "CASE WHEN c1.side IS NULL THEN c2.pk$i ELSE c1.pk$i END";
+  }
+  return
+    "SELECT CASE WHEN c1.side IS NULL THEN 'DELETE' " .
+      "WHEN c2.side IS NULL THEN 'INSERT' ELSE 'UPDATE' END AS op, " .
+      join(', ', @keys) . " " .
+    "FROM (SELECT 1 AS side, $tcs1 AS tcs, " .
+      key_pk_get(0, 0, 'pgsql', $k1, 'AS') . " FROM $t1$cond) AS c1 " .
+    "FULL JOIN (SELECT 2 AS side, $tcs2 AS tcs, " .
+      key_pk_get(0, 0, 'pgsql', $k2, 'AS') . " FROM $t2$cond) AS c2 " .
+    "ON (" . join(' AND ', @on) . ") " .
+    "WHERE c1.side IS NULL OR c2.side IS NULL OR c1.tcs<>c2.tcs";
+}
+
+# compute differences with one query returning (operation, key...) rows
+# ($count, $ins, $upt, $del) = join_differences($dbh, $db, $query)
+# globals: $verb $report
+sub join_differences($$$)
+{
+  my ($dbh, $db, $query) = @_;
+  my (@insert, @update, @delete); # results
+  my %results = ('INSERT' => \@insert, 'UPDATE' => \@update,
+                 'DELETE' => \@delete);
+  my $count = 0;
+  $query_nb++;
+  $query_sz += length($query);
+  verb 3, "$query_nb\t$query";
+  # no asynchronous query: we need the result right away
+  my $sth = $dbh->prepare($query);
+  $sth->execute();
+  while (my ($op, @key) = $sth->fetchrow_array()) {
+    die "unexpected join operation: $op" unless exists $results{$op};
+    $count++;
+    $query_fr0++;
+    push @{$results{$op}}, [@key];
+    print "$op @key\n" if $report;
+  }
+  $sth->finish();
+  return ($count, \@insert, \@update, \@delete);
+}
+
+# sampled key checksums are a contiguous range of 2**20 slots which split
+# the non-negative half of the key checksum values, as these are the same
+# whether checksums are signed or not. tuples are grouped by their 10 lower
+# key checksum bits for comparison.
+my ($sample_bits, $group_bits) = (20, 10);
+
+# query for (group, count, tcs) of tuples with a key checksum in [$lo, $hi],
+# or of all tuples if $lo is undef. the range may be served by an index on
+# a provided key checksum attribute, or on the key under --use-key.
+# sample_query($db, $table, $kcs, $tcs, $lo, $hi)
+# globals: $where $agg
+sub sample_query($$$$$$)
+{
+  my ($db, $table, $kcs, $tcs, $lo, $hi) = @_;
+  my $group = &{$M{$db}{andop}}($kcs, (1 << $group_bits) - 1);
+  my @cond;
+  push @cond, "($where)" if $where;
+  push @cond, "$kcs BETWEEN $lo AND $hi" if defined $lo;
+  return
+    "SELECT $group AS kcs, COUNT(*) AS cnt, $M{$db}{$agg}($tcs) AS tcs " .
+    "FROM $table" . (@cond? ' WHERE ' . join(' AND ', @cond): '') . " " .
+    "GROUP BY $group";
+}
+
+# ($min, $max) = sample_bounds($dbh, $db, $table, $key)
+# bounds of a key, which are read from its index
+# globals: $where
+sub sample_bounds($$$$)
+{
+  my ($dbh, $db, $table, $key) = @_;
+  my $query = "SELECT MIN($key), MAX($key) FROM $table" .
+    ($where? " WHERE $where": '');
+  $query_nb++;
+  $query_sz += length($query);
+  verb 3, "$query_nb\t$query";
+  dbh_materialize($dbh, $db);
+  async_wait($dbh, $db, 'sample bounds') if $async;
+  my ($min, $max) = $dbh->selectrow_array($query);
+  dbh_serialize($dbh, $db);
+  return ($min, $max);
+}
+
+# fetch sampled groups as a hash kcs => "count:tcs"
+# ($groups, $count) = sample_fetch($dbh, $db, $query)
+sub sample_fetch($$$)
+{
+  my ($dbh, $db, $query) = @_;
+  my (%groups, $count);
+  $query_nb++;
+  $query_sz += length($query);
+  verb 3, "$query_nb\t$query";
+  dbh_materialize($dbh, $db);
+  async_wait($dbh, $db, 'sample') if $async;
+  my $sth = $dbh->prepare($query);
+  $sth->execute();
+  while (my ($kcs, $cnt, $tcs) = $sth->fetchrow_array()) {
+    $query_fr++;
+    $groups{$kcs} = "$cnt:$tcs";
+    $count += $cnt;
+  }
+  $sth->finish();
+  dbh_serialize($dbh, $db);
+  return (\%groups, $count || 0);
+}
+
+# compare sampled groups from both sides, return the number of differences
+sub sample_compare($$)
+{
+  my ($g1, $g2) = @_;
+  my $diffs = 0;
+  for my $kcs (keys %$g1) {
+    $diffs++ unless exists $$g2{$kcs} and $$g1{$kcs} eq $$g2{$kcs};
+  }
+  for my $kcs (keys %$g2) {
+    $diffs++ unless exists $$g1{$kcs};
+  }
+  return $diffs;
+}
+
+# invertible Bloom lookup table sketches of (kcs, tcs) pairs,
+# the cell layout and hashes must match "iblt.c".
+my @iblt_seeds = (433494437, 780291637, 1073676287); # PN_32_1 .. PN_32_3
+my $iblt_check = 1873012681; # PN_32_4
+
+# jenkins one-at-a-time hash of a byte string, as in "jenkins.c"
+sub jenkins($$)
+{
+  my ($h, $data) = @_;
+  my $len = length($data);
+  for my $c (unpack('C*', $data)) {
+    $h = ($h + ($c ^ $len)) & 0xffffffff;
+    $h = ($h + ($h << 10)) & 0xffffffff;
+    $h ^= $h >> 6;
+  }
+  $h = ($h + ($h << 3)) & 0xffffffff;
+  $h = ($h ^ (($h >> 11) + $len)) & 0xffffffff;
+  return ($h + ($h << 15)) & 0xffffffff;
+}
+
+# ($check, @cells) = iblt_hashes($ncells, $kcs, $tcs)
+sub iblt_hashes($$$)
+{
+  my ($ncells, $kcs, $tcs) = @_;
+  my $item = pack('q<q<', $kcs, $tcs);
+  my $part = int($ncells / @iblt_seeds);
+  return (jenkins($iblt_check, $item),
+          map { $_ * $part + jenkins($iblt_seeds[$_], $item) % $part }
+            0 .. $#iblt_seeds);
+}
+
+# query for the sketch of one side, with values normalized to their size
+# globals: $tup_cs $key_cs $usekey $where $kcs_size $checksize
+sub iblt_query($$$$$)
+{
+  my ($db, $name, $table, $skey, $ncells) = @_;
+  my ($kcs, $tcs, $from) = ('kcs', 'tcs', "${name}0");
+  if (defined $tup_cs)
+  {
+    $tcs = $tup_cs;
+    $kcs = $key_cs if defined $key_cs;
+    $kcs = "@$skey" if $usekey;
+    $from = $table . ($where? " WHERE $where": '');
+  }
+  my ($ksz, $tsz) = ($usekey? 8: $kcs_size, $checksize);
+  $kcs = &{$M{$db}{andop}}($kcs, 2**(8*$ksz)-1) if $ksz < 8;
+  $tcs = &{$M{$db}{andop}}($tcs, 2**(8*$tsz)-1) if $tsz < 8;
+  return "SELECT IBLT($ncells, $kcs, $tcs) FROM $from";
+}
+
+# fetch the sketch of one side, undef if the table is empty
+sub iblt_fetch($$$)
+{
+  my ($dbh, $db, $query) = @_;
+  $query_nb++;
+  $query_sz += length($query);
+  verb 3, "$query_nb\t$query";
+  dbh_materialize($dbh, $db);
+  async_wait($dbh, $db, 'sketch') if $async;
+  my ($sketch) = $dbh->selectrow_array($query);
+  $query_fr++;
+  dbh_serialize($dbh, $db);
+  return $sketch;
+}
+
+# decode the difference of two sketches by peeling pure cells.
+# return a list of [kcs, tcs, side] items, or undef if decoding failed.
+sub iblt_decode($$$)
+{
+  my ($ncells, $s1, $s2) = @_;
+  use integer;
+  my $zero = "\0" x (32 * $ncells);
+  $s1 = $zero unless defined $s1;
+  $s2 = $zero unless defined $s2;
+  die "unexpected sketch sizes: " . length($s1) . " " . length($s2)
+    unless length($s1) == length($zero) and length($s2) == length($zero);
+  # cells are (count, kcs xor, tcs xor, check xor) 64 bits integers
+  my @c1 = unpack('q<*', $s1);
+  my @c2 = unpack('q<*', $s2);
+  my @cells = map { $_ % 4? $c1[$_] ^ $c2[$_]: $c1[$_] - $c2[$_] } 0 .. $#c1;
+  my @items;
+  my @todo = (0 .. $ncells-1);
+  while (@todo and @items <= $ncells)
+  {
+    my $i = pop @todo;
+    my ($n, $kcs, $tcs, $chk) = @cells[4*$i .. 4*$i+3];
+    next unless $n == 1 or $n == -1;
+    my ($check, @idx) = iblt_hashes($ncells, $kcs, $tcs);
+    next unless $chk == $check;
+    # pure cell, this item is only in one of the sketches
+    push @items, [$kcs, $tcs, $n == 1? 1: 2];
+    for my $j (@idx) {
+      $cells[4*$j] -= $n;
+      $cells[4*$j+1] ^= $kcs;
+      $cells[4*$j+2] ^= $tcs;
+      $cells[4*$j+3] ^= $check;
+      push @todo, $j;
+    }
+  }
+  # some items could not be peeled
+  for my $c (@cells) {
+    return undef if $c;
+  }
+  return \@items;
+}
+
+# reference tree file: a text header of "name=value" lines ended by an
+# empty line, then the little-endian records of each level from 0 up, then
+# the level 0 key values, and a trailer of "name=value" lines with the rows
+# and offsets of each level, ended by an empty line and its own offset.
+# level 0 records are (kcs, tcs, key offset, key length), other levels are
+# (kcs, tcs). The records of a level are sorted by bucket of the upper level
+# then by kcs, so that the rows of a bucket are found by binary search.
+my $tree_magic = 'pg_comparator tree 2';
+
+# options which must be the same when exporting and importing a tree
+sub tree_params()
+{
+  return ('checksum-function' => $checksum, 'checksum-size' => $checksize,
+          'key-checksum-size' => $kcs_size, 'null' => $null,
+          'aggregate' => $agg, 'separator' => $sep, 'use-key' => $usekey,
+          'use-null' => $usenull, 'where' => $where,
+          'key-checksum' => defined $key_cs? $key_cs: '',
+          'tuple-checksum' => defined $tup_cs? $tup_cs: '');
+}
+
+# record layout of a tree level
+sub tree_format($)
+{
+  my ($level) = @_;
+  return $level? ('q<q<', 16): ('q<q<Q<L<', 28);
+}
+
+# tree_export($file, $dbh, $db, $name, $table, $keys, $cols, $count, @masks)
+# write the checksum and summary tables of one side to a file
+sub tree_export($$$$$$$$@)
+{
+  my ($file, $dbh, $db, $name, $table, $keys, $cols, $count, @masks) = @_;
+  verb 1, "exporting tree to $file...";
+  my %params = tree_params();
+  open my $fh, '>', $file or die "cannot write tree file $file: $!";
+  binmode $fh;
+  # level 0 key values are appended once all levels are written
+  open my $kh, '+>', undef or die "cannot create temporary file: $!";
+  binmode $kh;
+  print $fh "$tree_magic\n",
+    (map { "$_=$params{$_}\n" } sort keys %params),
+    "db=$db\n", "keys=" . join(',', @$keys) . "\n",
+    "columns=" . join(',', @$cols) . "\n", "size=$count\n",
+    "masks=@masks\n", "\n";
+  my ($koff, @rows, @offsets) = (0);
+  for my $level (0 .. @masks-1)
+  {
+    push @offsets, tell $fh;
+    my $tab = $name . $level;
+    $tab = $table if $tup_cs and $level==0;
+    $tab = slim_join($db, $tab, $table) if $slim and $level==0;
+    # group the rows by bucket of the upper level, see tree_bucket
+    my $sth = selkcs($dbh, $db, $tab, $keys, $level,
+                     $level < $#masks? $masks[$level+1]: 0, !$level);
+    async_wait($dbh, $db, 'export') if $async;
+    my ($format) = tree_format($level);
+    my $n = 0;
+    while (my ($kcs, $tcs, @key) = $sth->fetchrow_array())
+    {
+      $n++;
+      if ($level) {
+        print $fh pack($format, $kcs, $tcs);
+        next;
+      }
+      # flag is 0 for NULL, 2 for utf8 strings
+      my $kdata = '';
+      for my $v (@key) {
+        my $flag = defined $v? (utf8::is_utf8($v)? 2: 1): 0;
+        $v = '' unless defined $v;
+        utf8::encode($v) if $flag == 2;
+        $kdata .= pack('Cw/a*', $flag, $v);
+      }
+      print $fh pack($format, $kcs, $tcs, $koff, length $kdata);
+      print $kh $kdata;
+      $koff += length $kdata;
+    }
+    $sth->finish();
+    if ($level) { $query_fr += $n; } else { $query_fr0 += $n; }
+    push @rows, $n;
+  }
+  push @offsets, tell $fh;
+  seek $kh, 0, 0 or die "cannot read temporary file: $!";
+  my $buf;
+  while (read $kh, $buf, 65536) {
+    print $fh $buf;
+  }
+  close $kh;
+  my $trailer = tell $fh;
+  print $fh "rows=@rows\n", "offsets=@offsets\n", "key-size=$koff\n", "\n",
+    pack('Q<', $trailer);
+  close $fh or die "cannot write tree file $file: $!";
+  verb 2, "tree exported: rows=(@rows)";
+}
+
+# read $len bytes at offset $off of an imported tree file
+sub tree_read($$$)
+{
+  my ($tree, $off, $len) = @_;
+  my ($fh, $file) = ($$tree{fh}, $$tree{file});
+  return '' unless $len;
+  seek $fh, $off, 0 or die "cannot seek tree file $file: $!";
+  my $buf;
+  my $n = read $fh, $buf, $len;
+  die "cannot read tree file $file: " . (defined $n? 'truncated': $!)
+    unless defined $n and $n == $len;
+  return $buf;
+}
+
+# "name=value" lines up to an empty line
+sub tree_header($$)
+{
+  my ($fh, $h) = @_;
+  while (my $line = <$fh>) {
+    return if $line eq "\n";
+    chomp $line;
+    my ($n, $v) = split /=/, $line, 2;
+    $$h{$n} = $v;
+  }
+}
+
+# open a tree file and check that it matches the current options.
+# only the header and trailer are read, records are read when selected.
+sub tree_import($)
+{
+  my ($file) = @_;
+  verb 1, "importing tree from $file...";
+  open my $fh, '<', $file or die "cannot read tree file $file: $!";
+  binmode $fh;
+  my $magic = <$fh>;
+  die "unexpected tree file $file"
+    unless defined $magic and $magic eq "$tree_magic\n";
+  my %h;
+  tree_header($fh, \%h);
+  my ($start, $end) = (tell $fh, -s $fh);
+  my %tree = (fh => $fh, file => $file);
+  die "truncated tree file $file" if $end < $start + 8;
+  my ($trailer) = unpack('Q<', tree_read(\%tree, $end - 8, 8));
+  die "unexpected trailer in tree file $file"
+    unless $trailer >= $start and $trailer <= $end - 8;
+  seek $fh, $trailer, 0 or die "cannot seek tree file $file: $!";
+  tree_header($fh, \%h);
+  my %params = tree_params();
+  for my $n (sort keys %params) {
+    die "tree file $file was built with --$n='$h{$n}', got '$params{$n}'"
+      unless defined $h{$n} and $h{$n} eq $params{$n};
+  }
+  %tree = (%tree, size => $h{size}, masks => [split ' ', $h{masks}],
+           rows => [split ' ', $h{rows}], keys => [split /,/, $h{keys}],
+           columns => [split /,/, $h{columns}],
+           offsets => [split ' ', $h{offsets}], ksize => $h{'key-size'});
+  die "unexpected levels in tree file $file"
+    unless @{$tree{masks}} and @{$tree{masks}} == @{$tree{rows}} and
+           @{$tree{offsets}} == @{$tree{rows}} + 1;
+  # records are contiguous, followed by the key values and the trailer
+  my $off = $start;
+  for my $level (0 .. $#{$tree{rows}}) {
+    die "unexpected layout in tree file $file"
+      unless $tree{offsets}[$level] == $off;
+    $off += (tree_format($level))[1] * $tree{rows}[$level];
+  }
+  die "unexpected layout in tree file $file"
+    unless $tree{offsets}[-1] == $off and $off + $tree{ksize} == $trailer;
+  verb 2, "tree imported: rows=(@{$tree{rows}})";
+  return \%tree;
+}
+
+# read $n records of a tree level from row $i
+# level 0 records are [kcs, tcs, row, key offset, key length]
+# other level records are [kcs, tcs, row]
+sub tree_records($$$$)
+{
+  my ($tree, $level, $i, $n) = @_;
+  my ($format, $sz) = tree_format($level);
+  my $data = tree_read($tree, $$tree{offsets}[$level] + $sz * $i, $sz * $n);
+  return map {
+    my ($kcs, $tcs, @kref) = unpack($format, substr($data, $sz * $_, $sz));
+    [$kcs, $tcs, $i + $_, @kref];
+  } 0 .. $n-1;
+}
+
+# level 0 key values of a record, decoded only when needed
+sub tree_key($$)
+{
+  my ($tree, $rec) = @_;
+  my @vals = unpack('(Cw/a*)*',
+                    tree_read($tree, $$tree{offsets}[-1] + $$rec[3], $$rec[4]));
+  my @key;
+  while (my ($flag, $v) = splice @vals, 0, 2) {
+    utf8::decode($v) if $flag == 2;
+    push @key, $flag? $v: undef;
+  }
+  die "unexpected key values in tree file $$tree{file}"
+    unless @key == @{$$tree{keys}};
+  return @key;
+}
+
+# records of a level whose kcs & $mask is $bucket, in kcs order
+sub tree_bucket($$$$)
+{
+  my ($tree, $level, $mask, $bucket) = @_;
+  # binary search of the first record of the bucket
+  my ($lo, $hi) = (0, $$tree{rows}[$level]);
+  while ($lo < $hi) {
+    my $mid = ($lo + $hi) >> 1;
+    my ($rec) = tree_records($tree, $level, $mid, 1);
+    if (($$rec[0] & $mask) < $bucket) { $lo = $mid + 1; } else { $hi = $mid; }
+  }
+  # then read its records by chunks
+  my @recs;
+  while ($lo < $$tree{rows}[$level]) {
+    my $n = $$tree{rows}[$level] - $lo;
+    $n = 64 if $n > 64;
+    for my $rec (tree_records($tree, $level, $lo, $n)) {
+      return @recs if ($$rec[0] & $mask) != $bucket;
+      push @recs, $rec;
+    }
+    $lo += $n;
+  }
+  return @recs;
+}
+
+# minimal statement handler interface on rows already in memory
+{
+  package MemoryCursor;
+  sub new { my ($class, @rows) = @_;
+            return bless { Active => 1, rows => \@rows }, $class; }
+  sub fetchrow_array { my ($self) = @_;
+                       my $row = shift @{$self->{rows}};
+                       $self->{Active} = 0 unless defined $row;
+                       return defined $row? @$row: (); }
+  sub finish { my ($self) = @_; $self->{Active} = 0; }
+}
+
+# same interface on the records of an imported tree level, either given
+# or read by chunks, with level 0 keys decoded as they are fetched
+{
+  package TreeCursor;
+  sub new { my ($class, $tree, $level, $recs) = @_;
+            return bless { Active => 1, tree => $tree, level => $level,
+                           recs => $recs || [], next => 0,
+                           end => $recs? 0: $$tree{rows}[$level] }, $class; }
+  sub fetchrow_array {
+    my ($self) = @_;
+    my ($tree, $level, $recs) = @$self{qw(tree level recs)};
+    if (not @$recs and $self->{next} < $self->{end}) {
+      my $n = $self->{end} - $self->{next};
+      $n = 1024 if $n > 1024;
+      @$recs = main::tree_records($tree, $level, $self->{next}, $n);
+      $self->{next} += $n;
+    }
+    my $rec = shift @$recs;
+    unless (defined $rec) {
+      $self->{Active} = 0;
+      return ();
+    }
+    return ($$rec[0], $$rec[1],
+            ($level or $usekey)? (): main::tree_key($tree, $rec));
+  }
+  sub finish { my ($self) = @_; $self->{Active} = 0; }
+}
+
+# same as selkcs on an imported tree level
+# globals: $tree1
+sub tree_select($$@)
+{
+  my ($level, $mask, @kcs) = @_;
+  # the top level is scanned
+  return TreeCursor->new($tree1, $level) unless @kcs;
+  my %seen;
+  my @recs = map { tree_bucket($tree1, $level, $mask, $_) }
+               grep { not $seen{$_}++ } @kcs;
+  # back to the kcs order of selkcs, rows of one kcs are in the same bucket
+  @recs = sort { $$a[0] <=> $$b[0] or $$a[2] <=> $$b[2] } @recs;
+  return TreeCursor->new($tree1, $level, \@recs);
+}
+
+# same as get_bulk_keys on an imported tree
+# globals: $tree1 $usekey $report
+sub tree_bulk_keys($@)
+{
+  my ($nature, @kcs_masks) = @_;
+  verb 1, "investigating $nature chunks (@kcs_masks) in tree";
+  my $masks = $$tree1{masks};
+  my @keys = (); # results
+  for my $bulk (@kcs_masks) {
+    my ($kcs, $mask) = split '/', $bulk;
+    my ($level) = grep { $$masks[$_] == $mask } 1 .. @$masks-1;
+    die "unexpected bulk mask $mask" unless defined $level;
+    # descend to level 0 through the buckets of each level
+    my @recs = ([$kcs]);
+    while ($level--) {
+      @recs = map { tree_bucket($tree1, $level, $$masks[$level+1], $$_[0]) }
+                @recs;
+    }
+    for my $rec (@recs) {
+      my @key = $usekey? ($$rec[0]): tree_key($tree1, $rec);
+      push @keys, [@key];
+      print "$nature @key\n" if $report;
+    }
+  }
+  verb 4, "$nature count=" . @keys;
+  return \@keys;
+}
+
+# key range tree: each side is described by [$dbh, $db, $table, $key, $tcs]
+
+# minimal server versions with window functions for quantiles
+my %window_versions = ('pgsql' => '8.4', 'mysql' => '8.0',
+                       'mariadb' => '10.2', 'sqlite' => '3.25');
+
+# die unless the server provides window functions
+sub range_check_version($$)
+{
+  my ($dbh, $db) = @_;
+  my $query = $db eq 'sqlite'? 'SELECT sqlite_version()': 'SELECT VERSION()';
+  $query_meta++;
+  async_wait($dbh, $db, 'version') if $async;
+  my ($version) = $dbh->selectrow_array($query);
+  # "PostgreSQL 12.3 on ...", "8.0.33", "10.5.12-MariaDB-log", "3.31.1"
+  my ($server, $num) =
+    $version =~ /MariaDB/i? ('mariadb', $version):
+    $version =~ /PostgreSQL\s+(\S+)/? ($db, $1): ($db, $version);
+  my @have = $num =~ /(\d+)/g;
+  my @need = split /\./, $window_versions{$server};
+  for my $i (0 .. $#need) {
+    my $h = $have[$i] || 0;
+    last if $h > $need[$i];
+    die "sorry, --key-ranges requires window functions, " .
+        "that is $server $window_versions{$server} or later, got $version"
+      if $h < $need[$i];
+  }
+}
+
+# ($cond, @values) = range_cond($key, $lo, $hi) for range ]lo, hi]
+# globals: $where
+sub range_cond($$$)
+{
+  my ($key, $lo, $hi) = @_;
+  my (@cond, @values);
+  push @cond, "($where)" if $where;
+  if (defined $lo) { push @cond, "$key > ?"; push @values, $lo; }
+  if (defined $hi) { push @cond, "$key <= ?"; push @values, $hi; }
+  return ((@cond? ' WHERE ' . join(' AND ', @cond): ''), @values);
+}
+
+# fetch all rows of a range query
+sub range_query($$$@)
+{
+  my ($dbh, $db, $query, @values) = @_;
+  $query_nb++;
+  $query_sz += length($query);
+  verb 3, "$query_nb\t$query (@values)";
+  my $rows = $dbh->selectall_arrayref($query, undef, @values);
+  $query_fr += @$rows;
+  return $rows;
+}
+
+# ($count, $tcs) = range_summary($side, $lo, $hi)
+# globals: $agg
+sub range_summary($$$)
+{
+  my ($side, $lo, $hi) = @_;
+  my ($dbh, $db, $table, $key, $tcs) = @$side;
+  my ($cond, @values) = range_cond($key, $lo, $hi);
+  my $rows = range_query($dbh, $db,
+    "SELECT COUNT(*), $M{$db}{$agg}($tcs) FROM $table$cond", @values);
+  my ($count, $sum) = @{$$rows[0]};
+  return ($count, defined $sum? $sum: '');
+}
+
+# quantiles of the key so as to split a range of $count tuples
+sub range_bounds($$$$)
+{
+  my ($side, $lo, $hi, $count) = @_;
+  my ($dbh, $db, $table, $key, $tcs) = @$side;
+  my ($cond, @values) = range_cond($key, $lo, $hi);
+  my $step = int(($count + (1 << $factor) - 1) / (1 << $factor));
+  my $rows = range_query($dbh, $db,
+    "SELECT pgc_k FROM (" .
+      "SELECT $key AS pgc_k, ROW_NUMBER() OVER (ORDER BY $key) AS pgc_n " .
+      "FROM $table$cond) AS pgc_r " .
+    "WHERE pgc_n % $step = 0 ORDER BY pgc_k", @values);
+  return map { $$_[0] } @$rows;
+}
+
+# compare the tuples of a small range, append differences to lists
+# globals: $report
+sub range_leaf($$$$$$$)
+{
+  my ($s1, $s2, $lo, $hi, $ins, $upt, $del) = @_;
+  my @rows;
+  for my $side ($s1, $s2) {
+    my ($dbh, $db, $table, $key, $tcs) = @$side;
+    my ($cond, @values) = range_cond($key, $lo, $hi);
+    push @rows, range_query($dbh, $db,
+      "SELECT $key, $tcs FROM $table$cond ORDER BY $key", @values);
+    # sqlite column types are not checked
+    for my $row (@{$rows[-1]}) {
+      die "key-ranges option requires an integer key, got '$$row[0]'"
+        unless defined $$row[0] and $$row[0] =~ /^-?\d+$/;
+    }
+  }
+  my ($r1, $r2) = @rows;
+  my ($i1, $i2) = (0, 0);
+  while ($i1 < @$r1 or $i2 < @$r2) {
+    $query_fr0++;
+    my $cmp = $i1 >= @$r1? 1: $i2 >= @$r2? -1:
+      $$r1[$i1][0] <=> $$r2[$i2][0];
+    if ($cmp < 0) {
+      push @$ins, [$$r1[$i1][0]];
+      print "INSERT $$r1[$i1][0]\n" if $report;
+      $i1++;
+    }
+    elsif ($cmp > 0) {
+      push @$del, [$$r2[$i2][0]];
+      print "DELETE $$r2[$i2][0]\n" if $report;
+      $i2++;
+    }
+    else {
+      if ($$r1[$i1][1] ne $$r2[$i2][1]) {
+        push @$upt, [$$r1[$i1][0]];
+        print "UPDATE $$r1[$i1][0]\n" if $report;
+      }
+      $i1++, $i2++;
+    }
+  }
+}
+
+# compute differences by descending into differing key ranges
+# ($count, $ins, $upt, $del) = range_differences($side1, $side2)
+# globals: $factor $verb
+sub range_differences($$)
+{
+  my ($s1, $s2) = @_;
+  my (@insert, @update, @delete);
+  my ($level, @ranges) = (0, [undef, undef]);
+  while (@ranges) {
+    verb 2, "key range level $level: " . scalar(@ranges) . " ranges";
+    my @next;
+    for my $range (@ranges) {
+      my ($lo, $hi) = @$range;
+      my ($c1, $tcs1) = range_summary($s1, $lo, $hi);
+      my ($c2, $tcs2) = range_summary($s2, $lo, $hi);
+      next if $c1 == $c2 and $tcs1 eq $tcs2;
+      if ($c1 + $c2 <= 2 << $factor) {
+        range_leaf($s1, $s2, $lo, $hi, \@insert, \@update, \@delete);
+        next;
+      }
+      # split on the side with more tuples, so that sub-ranges shrink
+      my @bounds = $c1 >= $c2?
+        range_bounds($s1, $lo, $hi, $c1): range_bounds($s2, $lo, $hi, $c2);
+      for my $bound (@bounds) {
+        push @next, [$lo, $bound];
+        $lo = $bound;
+      }
+      push @next, [$lo, $hi];
+    }
+    @ranges = @next;
+    $level++;
+  }
+  return (@insert + @update + @delete, \@insert, \@update, \@delete);
+}
+
 sub table_cleanup($$$$)
 {
   my ($dbh, $db, $name, $levels) = @_;
@@ -2815,15 +4055,22 @@ sub list_cmp(\@\@)
 
 # this is the core of the comparison algorithm
 # compute differences by climbing up the tree, output result on the fly.
-# differences($dbh1, $dbh2, $db1, $db2, $n1, $n2, $t1, $t2, $k1, $k2, @masks)
-# globals: $max_report $verb $report
-sub differences($$$$$$$$$$@)
+# differences($dbh1, $dbh2, $db1, $db2, $n1, $n2, $t1, $t2, $k1, $k2,
+#             $start, @masks)
+# $start is an optional [$mask, @kcs] list of level 0 buckets to investigate.
+# globals: $max_report $verb $report $tree1
+sub differences($$$$$$$$$$$@)
 {
-  my ($dbh1, $dbh2, $db1, $db2, $n1, $n2, $t1, $t2, $k1, $k2, @masks) = @_;
+  my ($dbh1, $dbh2, $db1, $db2, $n1, $n2, $t1, $t2, $k1, $k2, $start,
+      @masks) = @_;
   my $level = @masks-1; # number of last summary table
   my ($mask, $count, $todo) = (0, 0, 1); # mask of previous table
   my (@insert, @update, @delete, @mask_insert, @mask_delete); # results
   my @kcs = ();
+  if (defined $start) {
+    ($level, $mask, @kcs) = (0, @$start);
+    $todo = @kcs;
+  }
 
   dbh_materialize($dbh1, $db1);
   dbh_materialize($dbh2, $db2);
@@ -2846,12 +4093,15 @@ sub differences($$$$$$$$$$@)
     # select statement handlers
     my ($tab1, $tab2) = ($n1.$level, $n2.$level);
     ($tab1, $tab2) = ($t1, $t2) if $tup_cs and $level==0;
-    my $s1 = selkcs($dbh1, $db1, ${tab1}, $k1, $level, $mask, !$level, @kcs);
+    ($tab1, $tab2) = (slim_join($db1, $tab1, $t1), slim_join($db2, $tab2, $t2))
+      if $slim and $level==0;
+    my $s1 = $tree1? tree_select($level, $mask, @kcs):
+      selkcs($dbh1, $db1, ${tab1}, $k1, $level, $mask, !$level, @kcs);
     my $s2 = selkcs($dbh2, $db2, ${tab2}, $k2, $level, $mask, !$level, @kcs);
 
     # wait for results...
     if ($async) {
-      async_wait($dbh1, $db1, 'diff 1');
+      async_wait($dbh1, $db1, 'diff 1') unless $tree1;
       async_wait($dbh2, $db2, 'diff 2');
     }
 
@@ -2968,6 +4218,199 @@ sub differences($$$$$$$$$$@)
   return ($count, \@insert, \@update, \@delete, \@mask_insert, \@mask_delete);
 }
 
+####################################################### PARALLEL SYNCHRONIZATION
+
+# shard of a key, so that a key is always handled by the same job
+# globals: $sep
+sub key_shard($$)
+{
+  my ($key, $jobs) = @_;
+  return jenkins(0, join($sep, map { defined $_? $_: '' } @$key)) % $jobs;
+}
+
+# wait for the current statement of a shard, and die if it failed,
+# as asynchronous results may not raise errors, e.g. with mysql.
+sub sync_wait($$$)
+{
+  my ($dbh, $db, $from) = @_;
+  return unless $async and exists $current_async_query{$dbh};
+  my $query = $current_async_query{$dbh};
+  my ($res) = async_wait($dbh, $db, $from);
+  die "$from failed: " . ($dbh->errstr || 'no result') . "\n\t$query\n"
+    if $dbh->err or not defined $res;
+}
+
+# send a statement to a shard once its previous statement succeeded
+sub sync_do($$$)
+{
+  my ($dbh, $db, $query) = @_;
+  sync_wait($dbh, $db, 'sync');
+  sql_do($dbh, $db, $query);
+}
+
+# send the next batch of each shard, the query is asynchronous.
+# sync_round($db, $dbhs, $shards, $sql)
+# $sql($dbh, @keys) returns the statement for a batch of keys of a shard.
+sub sync_round($$$$)
+{
+  my ($db, $dbhs, $shards, $sql) = @_;
+  my $todo = 0;
+  for my $i (0 .. @$dbhs-1) {
+    next unless $$shards[$i] and @{$$shards[$i]};
+    my @keys = splice @{$$shards[$i]}, 0, $sync_batch;
+    sync_do($$dbhs[$i], $db, &$sql($$dbhs[$i], @keys));
+    $todo += @{$$shards[$i]};
+  }
+  return $todo;
+}
+
+# delete, update then insert tuples on several target connections, sharded
+# by key. all shards are committed with a two-phase commit, or none.
+# sync_parallel($dbh1, $db1, $t1, $k1, $c1, $db2, $t2, $k2, $c2,
+#               \@dbhs, \@deletes, \@updates, \@inserts)
+# globals: $where $async $query_data $sync_batch
+sub sync_parallel($$$$$$$$$$$$$)
+{
+  my ($dbh1, $db1, $t1, $k1, $c1, $db2, $t2, $k2, $c2,
+      $dbhs, $dels, $upts, $inss) = @_;
+  my ($jobs, $xa) = (scalar @$dbhs, $M{$db2}{xa});
+  my @xids = map { "pgc_${$}_" . time() . "_$_" } 0 .. $jobs-1;
+  my (@del_shards, @upt_shards, @ins_shards, @prepared);
+  push @{$del_shards[key_shard($_, $jobs)]}, $_ for @$dels;
+  push @{$upt_shards[key_shard($_, $jobs)]}, $_ for @$upts;
+  push @{$ins_shards[key_shard($_, $jobs)]}, $_ for @$inss;
+  my $cond = $where? "($where) AND ": '';
+  die "there must be some columns to update" if @$upts and not @$c1;
+
+  # fetch values from the first table while other shards are busy,
+  # in the order of the keys, which are tagged by their index
+  my $fetch = sub {
+    my ($cols, @keys) = @_;
+    my $sel = "SELECT CASE " .
+      join(' ', map { "WHEN " . tuples_equal($dbh1, $k1, $keys[$_]) .
+                      " THEN $_" } 0 .. $#keys) .
+      " END, " . join(',', @$cols) . " FROM $t1 " .
+      "WHERE $cond" . tuples_equal($dbh1, $k1, @keys);
+    $query_nb++;
+    $query_sz += length($sel);
+    verb 3, "$query_nb\t$sel";
+    async_wait($dbh1, $db1, 'sync values') if $async;
+    my @rows;
+    for my $row (@{$dbh1->selectall_arrayref($sel)}) {
+      my $i = shift @$row;
+      $rows[$i] = $row;
+      $query_data++;
+    }
+    die "unexpected values fetched for synchronization"
+      unless @rows == @keys and not grep { not defined } @rows;
+    return \@rows;
+  };
+
+  eval {
+    for my $i (0 .. $jobs-1) {
+      if (exists $$xa{start}) {
+        sync_do($$dbhs[$i], $db2, sprintf($$xa{start}, $xids[$i]));
+      }
+      else {
+        $$dbhs[$i]->begin_work or die $$dbhs[$i]->errstr;
+      }
+    }
+
+    # all deletes are done before updates and inserts
+    while (sync_round($db2, $dbhs, \@del_shards, sub {
+        my ($dbh, @keys) = @_;
+        return "DELETE FROM $t2 WHERE $cond" . tuples_equal($dbh, $k2, @keys);
+      })) {}
+    sync_wait($_, $db2, 'sync delete') for @$dbhs;
+
+    # values differ for each key, so there is one update per shard and round,
+    # but the values of the next batch of every shard are fetched at once
+    while (grep { $_ and @$_ } @upt_shards)
+    {
+      my @batches =
+        map { [splice @{$upt_shards[$_] || []}, 0, $sync_batch] } 0 .. $jobs-1;
+      my @rows = @{&$fetch($c1, map { @$_ } @batches)};
+      # pair each key with its values, which are in the order of the batches
+      @batches = map { [map { [$_, shift @rows] } @$_] } @batches;
+      while (grep { @$_ } @batches) {
+        for my $i (0 .. $jobs-1) {
+          my $pair = shift @{$batches[$i]} or next;
+          my ($key, $row) = @$pair;
+          sync_do($$dbhs[$i], $db2, "UPDATE $t2 SET " .
+            join(', ', map { "$$c2[$_]=" . $$dbhs[$i]->quote($$row[$_]) }
+                         0 .. @$c2-1) .
+            " WHERE $cond" . tuples_equal($$dbhs[$i], $k2, $key));
+        }
+      }
+    }
+    sync_wait($_, $db2, 'sync update') for @$dbhs;
+
+    while (sync_round($db2, $dbhs, \@ins_shards, sub {
+        my ($dbh, @keys) = @_;
+        my $rows = &$fetch([@$k1, @$c1], @keys);
+        return "INSERT INTO $t2(" . join(',', @$k2, @$c2) . ") VALUES " .
+          join(',', map { quote_tuple($dbh, @$_) } @$rows);
+      })) {}
+
+    for my $i (0 .. $jobs-1) {
+      sync_do($$dbhs[$i], $db2, sprintf($$xa{end}, $xids[$i]))
+        if exists $$xa{end};
+      sync_do($$dbhs[$i], $db2, sprintf($$xa{prepare}, $xids[$i]));
+      sync_wait($$dbhs[$i], $db2, 'sync prepare');
+      push @prepared, $i;
+      # the transaction is over on the server side
+      $$dbhs[$i]->commit unless $$dbhs[$i]->{AutoCommit};
+    }
+  };
+
+  if ($@)
+  {
+    my $err = $@;
+    for my $i (0 .. $jobs-1) {
+      eval {
+        async_wait($$dbhs[$i], $db2, 'sync rollback') if $async;
+        if (grep { $_ == $i } @prepared) {
+          sql_do($$dbhs[$i], $db2, sprintf($$xa{rollback}, $xids[$i]));
+        }
+        elsif (exists $$xa{end}) {
+          sql_do($$dbhs[$i], $db2, sprintf($$xa{end}, $xids[$i]));
+          sql_do($$dbhs[$i], $db2, sprintf($$xa{rollback}, $xids[$i]));
+        }
+        else {
+          $$dbhs[$i]->rollback;
+        }
+        async_wait($$dbhs[$i], $db2, 'sync rollback') if $async;
+      };
+      warn "rollback of shard $i failed: $@" if $@;
+    }
+    die "parallel synchronization rolled back: $err";
+  }
+
+  # all shards are prepared, commit them
+  for my $i (0 .. $jobs-1) {
+    eval {
+      sync_do($$dbhs[$i], $db2, sprintf($$xa{commit}, $xids[$i]));
+      sync_wait($$dbhs[$i], $db2, 'sync commit');
+    };
+    warn "commit of shard $i failed, transaction $xids[$i] is still " .
+         "prepared: $@" if $@;
+  }
+}
+
+# lock rows of table $t2 by key before synchronizing them
+# lock_keys($dbh, $db, $t2, $k2, @keys)
+# globals: $where $async
+sub lock_keys($$$$@)
+{
+  my ($dbh, $db, $t2, $k2, @keys) = @_;
+  my $cond = $where? "($where) AND ": '';
+  while (my @batch = splice @keys, 0, $sync_batch) {
+    sql_do($dbh, $db, "SELECT 1 FROM $t2 WHERE $cond" .
+           tuples_equal($dbh, $k2, @batch) . " FOR UPDATE");
+  }
+  async_wait($dbh, $db, 'lock keys') if $async;
+}
+
 ####################################################################### OPTIONS
 
 use Getopt::Long qw(:config no_ignore_case);
@@ -2992,6 +4435,15 @@ GetOptions(
   # algorithm parameters and variants
   "use-key|uk|u!" => \$usekey,
   "key-checksum|kcs=s" => \$key_cs,
+  "key-checksum-size|kcs-size=i" => \$kcs_size,
+  "column-groups=i" => \$col_groups,
+  "key-ranges!" => \$key_ranges,
+  "slim!" => \$slim,
+  "iblt=i" => \$iblt,
+  "sync-jobs=i" => \$sync_jobs,
+  "snapshot:s" => \$snapshot,
+  "export-tree=s" => \$export_tree,
+  "import-tree=s" => \$import_tree,
   "use-null|usenull|un!" => \$usenull,
   "tuple-checksum|tup-checksum|tcs=s" => \$tup_cs,
   "size=i" => \$size,
@@ -3029,6 +4481,9 @@ GetOptions(
   "expect|e=i" => \$expect,
   "expect-warn" => \$expect_warn, # hidden option used by the validation
   "report|r!" => \$report,
+  "sample=f" => \$sample,
+  "sample-seed=i" => \$sample_seed,
+  "escalate!" => \$escalate,
   # parallelism
   "asynchronous|A!" => \$async,
   "na|nA|X" => sub { $async = 0; },
@@ -3041,15 +4496,32 @@ GetOptions(
   "long-read-len|lrl|L=i" => \$longreadlen,
   "version|V" => sub { print "$0 version is $script_version\n"; exit 0; },
   "pg-copy:i" => \$pg_copy,
-  "pg-text-cast" => \$pg_text_cast
+  "pg-text-cast" => \$pg_text_cast,
+  "join!" => \$do_join
 ) or die "$! (try $0 --help)";
 
+# whether some option only applies to the checksum tree algorithm,
+# so that the tables are not joined by default
+my $tree_options = $threads || $iblt || $slim || $kcs_size != 4 ||
+  ($col_groups and not $synchronize) ||
+  grep { defined } ($factor, $max_ratio, $max_levels, $max_report);
+die "sorry, --iblt, --slim, --key-checksum-size and --column-groups " .
+    "when comparing only apply to the checksum tree, not to --join"
+  if $do_join and ($iblt or $slim or $kcs_size != 4 or
+                   ($col_groups and not $synchronize));
+$factor = 7 unless defined $factor;
+$max_ratio = 0.1 unless defined $max_ratio;
+$max_levels = 0 unless defined $max_levels;
+
 # propagate expect specification
 $max_report = $expect
   if defined $expect and not $expect_warn and not defined $max_report;
 
 # set default locking if not set
-$do_lock = $synchronize if not defined $do_lock;
+# other connections write the second table with parallel synchronization
+# a snapshot gives a stable view without locking tables
+$do_lock = $synchronize && $sync_jobs <= 1 && !defined $snapshot
+  if not defined $do_lock;
 
 # handle stats option
 $stats = 'txt' if defined $stats and $stats eq '';
@@ -3130,6 +4602,55 @@ die "checksum should be 'md5', 'ck' or 'fnv', got ($checksum)"
 die "checksize must be 2, 4 or 8, got ($checksize)"
   unless $checksize =~ /^[248]$/;
 
+die "key checksize must be 4 or 8, got ($kcs_size)"
+  unless $kcs_size =~ /^[48]$/;
+
+die "column groups must be positive, got ($col_groups)"
+  if $col_groups < 0;
+
+die "sorry, --column-groups requires a checksum table, not --tuple-checksum"
+  if $col_groups and defined $tup_cs;
+
+die "sorry, --key-ranges is not implemented for firebird"
+  if $key_ranges and ($db1 eq 'firebird' or $db2 eq 'firebird');
+
+die "sorry, --column-groups requires a checksum table, not --key-ranges"
+  if $col_groups and $key_ranges;
+
+die "sorry, --column-groups requires keys in the checksum table, not --slim"
+  if $col_groups and $slim;
+
+# no key to replace in the checksum table
+$slim = 0 if $usekey or defined $tup_cs;
+
+if ($slim and not (exists $M{$db1}{locator} and exists $M{$db2}{locator})) {
+  warn "sorry, no row locator for $db1 or $db2, ignoring --slim";
+  $slim = 0;
+}
+
+die "iblt expected differences must be positive, got ($iblt)"
+  if $iblt < 0;
+
+die "sorry, --iblt is not implemented for firebird"
+  if $iblt and ($db1 eq 'firebird' or $db2 eq 'firebird');
+
+die "sorry, cannot both export and import a tree"
+  if defined $export_tree and defined $import_tree;
+
+die "sorry, a tree requires the checksum tree algorithm, " .
+    "not --join, --sample, --key-ranges or --iblt"
+  if (defined $export_tree or defined $import_tree) and
+     ($do_join or defined $sample or $key_ranges or $iblt);
+
+die "sorry, --import-tree cannot --synchronize or use --threads"
+  if defined $import_tree and ($synchronize or $threads);
+
+die "sample ratio must be in (0,1], got ($sample)"
+  if defined $sample and ($sample <= 0 or $sample > 1);
+
+die "sorry, --sample requires --escalate when synchronizing"
+  if defined $sample and $synchronize and not $escalate;
+
 die "aggregate must be 'xor' or 'sum', got ($agg)"
   unless $agg =~ /^(xor|sum)$/i;
 
@@ -3169,6 +4690,15 @@ die "--pg_copy must be strictly positive, got '$pg_copy'"
 die "sorry, threading does not seem to work with PostgreSQL driver"
   if not $debug and $threads and ($db1 eq 'pgsql' or $db2 eq 'pgsql');
 
+die "--sync-jobs must be strictly positive, got '$sync_jobs'"
+  if $sync_jobs <= 0;
+
+die "sorry, --sync-jobs requires a PostgreSQL or MySQL second table, " .
+    "without --lock or --column-groups"
+  if $sync_jobs > 1 and $synchronize and
+     (not exists $M{$db2}{xa} or $db1 eq 'firebird' or $do_lock or
+      $col_groups);
+
 die "sorry, --pg-copy currently requires --no-async"
   if not $debug and defined $pg_copy and $async;
 
@@ -3182,11 +4712,6 @@ if (not $debug and ($db1 eq 'sqlite' or $db2 eq 'sqlite'))
       warn "hash null handling does not work in mixed SQLite mode, using text";
       $null = 'text';
     }
-    # see unpack in PGC_MD5 definition?
-    if ($checksum eq 'md5') {
-      warn "md5 checksum does not work in mixed SQLite mode, using ck";
-      $checksum = 'ck';
-    }
     # signed integer issue...
     if ($agg eq 'xor' and ($db1 eq 'pgsql' or $db2 eq 'pgsql')) {
       warn "xor aggregate does not work in SQLite/PostgreSQL mode, using sum";
@@ -3255,9 +4780,36 @@ if (not $debug)
       warn "sorry, downgrading checksize to 4 for firebird";
       $checksize = 4;
     }
+    if ($kcs_size==8) {
+      warn "sorry, downgrading key checksize to 4 for firebird";
+      $kcs_size = 4;
+    }
   }
 }
 
+die "sorry, --sync-jobs requires asynchronous queries on both sides, " .
+    "without --no-async"
+  if $sync_jobs > 1 and $synchronize and not $async;
+
+# whether both tables can be compared with one query on one connection:
+# two sqlite files, or the same pgsql base or mysql server and user.
+# table locks are taken per connection, so the first one could not read
+# the second table locked by the other connection.
+my $can_join =
+  ($db1 eq $db2 and exists $M{$db1}{join} and
+   not defined $source1 and not defined $source2 and
+   # column group checksums are kept in the checksum table
+   not ($col_groups and $synchronize) and not $key_ranges and
+   not defined $export_tree and not defined $import_tree and
+   not $do_lock and
+   ($db1 eq 'sqlite' or
+    ($h1 eq $h2 and $p1 eq $p2 and $u1 eq $u2 and
+     ($db1 eq 'mysql' or $b1 eq $b2))));
+die "sorry, --join requires two SQLite files, or tables in the same " .
+    "PostgreSQL base or MySQL server and user, without --lock or --source-*"
+  if $do_join and not $can_join;
+$do_join = $can_join && !$tree_options unless defined $do_join;
+
 # consistency check for --lock & --transaction
 if ($do_lock and ($db1 eq 'pgsql' or $db2 eq 'pgsql')) {
   die "--lock requires --transaction for pgsql" unless $do_trans;
@@ -3266,6 +4818,23 @@ if ($do_lock and ($db1 eq 'sqlite' or $db2 eq 'sqlite')) {
   die "--lock requires --transaction for sqlite" unless $do_trans;
 }
 
+# consistency check for --snapshot
+if (defined $snapshot) {
+  die "sorry, --snapshot requires PostgreSQL or MySQL tables"
+    unless (defined $import_tree or exists $M{$db1}{snapshot}) and
+      exists $M{$db2}{snapshot};
+  die "--snapshot requires --transaction" unless $do_trans;
+  die "--snapshot and --lock are exclusive" if $do_lock;
+  die "--snapshot=id requires PostgreSQL tables"
+    if $snapshot ne '' and
+      (($db1 ne 'pgsql' and not defined $import_tree) or $db2 ne 'pgsql');
+  # each thread has its own connection, without the shared snapshot
+  die "sorry, --snapshot does not work with --threads" if $threads;
+  # creating a table commits the current transaction
+  die "--snapshot requires --temporary for mysql"
+    if not $temp and ($db1 eq 'mysql' or $db2 eq 'mysql');
+}
+
 # there is signed (pg)/unsigned (my) issue with key xor4 in mixed mode
 # at least with md5. note that the answer seems okay in the end, but more
 # path than necessary are investigated.
@@ -3324,6 +4893,8 @@ use Time::HiRes qw(gettimeofday tv_interval);
 my ($t0, $tcks, $tsum, $tmer, $tblk, $tsyn, $tclr, $tend);
 $t0 = [gettimeofday] if $stats;
 
+$tree1 = tree_import($import_tree) if defined $import_tree;
+
 verb 1, "connecting...";
 my ($thr1, $thr2);
 if ($threads)
@@ -3354,12 +4925,36 @@ if ($threads)
 }
 else
 {
-  ($dbh1) = build_conn($db1, $b1, $h1, $p1, $u1, $w1, $source1, $t1, 1);
+  # an imported tree replaces the first connection
+  ($dbh1) = build_conn($db1, $b1, $h1, $p1, $u1, $w1, $source1, $t1, 1)
+    unless $tree1;
+  # share the snapshot of the first connection with the second one
+  if (defined $snapshot and $snapshot eq '' and not $tree1 and
+      $db1 eq $db2 and exists $M{$db1}{export_snapshot} and
+      not defined $source1 and not defined $source2 and
+      $h1 eq $h2 and $p1 eq $p2 and $b1 eq $b2)
+  {
+    async_wait($dbh1, $db1, 'snapshot') if $async;
+    $query_meta++;
+    ($snapshot) = $dbh1->selectrow_array($M{$db1}{export_snapshot});
+    verb 2, "sharing snapshot $snapshot";
+  }
   ($dbh2) = build_conn($db2, $b2, $h2, $p2, $u2, $w2, $source2, $t2,
                        !$synchronize);
 }
 
 # get/set k/c defaults once connected
+if ($tree1) {
+  $k1 = $$tree1{keys} unless defined $k1;
+  $c1 = $$tree1{columns} unless defined $c1;
+  # the stored checksums only match the keys and columns of the file
+  die "tree file $$tree1{file} was built with keys (@{$$tree1{keys}}), " .
+      "got (@$k1)"
+    unless "@$k1" eq "@{$$tree1{keys}}";
+  die "tree file $$tree1{file} was built with columns " .
+      "(@{$$tree1{columns}}), got (@$c1)"
+    unless "@$c1" eq "@{$$tree1{columns}}";
+}
 if (not defined $k1) {
   $k1 = [get_table_pkey($dbh1, $db1, $b1, $t1)];
   warn "default key & attribute on first connection but not on second..."
@@ -3383,6 +4978,18 @@ die "empty key on second connection, must specify one" unless @$k2;
 die "key number of attributes does not match" unless @$k1 == @$k2;
 die "column number of attributes does not match" unless @$c1 == @$c2;
 
+# parallel jobs could wait on each other through another unique index
+if ($synchronize and $sync_jobs > 1)
+{
+  my $key = join ',', sort map { lc &{$M{$db2}{unquote}}($_) } @$k2;
+  for my $index (get_table_unique_keys($dbh2, $db2, $b2, $t2)) {
+    my @cols = map { defined $_? $_: '?' } @$index;
+    die "sorry, --sync-jobs cannot synchronize $t2 with unique index " .
+        "(@cols) other than the key"
+      unless join(',', sort map { lc } @cols) eq $key;
+  }
+}
+
 # whether to use nullability
 my ($pk1, $pk2, $pc1, $pc2);
 my $fmt1 = &{$M{$db1}{null}}($null, $checksum, $checksize);
@@ -3398,12 +5005,15 @@ dbh_materialize($dbh2, $db2);
 if ($usekey) {
   # key 1
   die "use-key option requires a scalar key, got (@$k1)" if @$k1 != 1;
-  my $type1 = col_type($dbh1, $dhpbt1, $db1, $$k1[0]);
-  # both next checks are usually okay from sqlite
-  warn "use-key option requires an integer key 1, got $type1"
-    unless $type1 =~ /int/i;
-  warn "use-key option requires a NOT NULL key 1"
-    unless col_is_not_null($dbh1, $dhpbt1, $$k1[0]);
+  # already checked when the tree was exported
+  if (not $tree1) {
+    my $type1 = col_type($dbh1, $dhpbt1, $db1, $$k1[0]);
+    # both next checks are usually okay from sqlite
+    warn "use-key option requires an integer key 1, got $type1"
+      unless $type1 =~ /int/i;
+    warn "use-key option requires a NOT NULL key 1"
+      unless col_is_not_null($dbh1, $dhpbt1, $$k1[0]);
+  }
   # key 2
   # size is already checked as same as k1
   my $type2 = col_type($dbh2, $dhpbt2, $db2, $$k2[0]);
@@ -3418,9 +5028,10 @@ if ($usenull)
 {
   # hmmm... I should ckeck that it is coherent
   # null-proctected keys, possibly hash or text
-  $pk1 = subs_null($fmt1, $dbh1, $dhpbt1, $k1);
+  # no checksums to compute on an imported tree
+  $pk1 = subs_null($fmt1, $dbh1, $dhpbt1, $k1) unless $tree1;
   $pk2 = subs_null($fmt2, $dbh2, $dhpbt2, $k2);
-  $pc1 = subs_null($fmt1, $dbh1, $dhpbt1, $c1);
+  $pc1 = subs_null($fmt1, $dbh1, $dhpbt1, $c1) unless $tree1;
   $pc2 = subs_null($fmt2, $dbh2, $dhpbt2, $c2);
 }
 else
@@ -3434,9 +5045,174 @@ else
 dbh_serialize($dbh1, $db1);
 dbh_serialize($dbh2, $db2);
 
-verb 1, "checksumming...";
-my ($count1, $count2);
-if ($tup_cs) # no checksum table to compute
+# whether the checksum tree algorithm is needed to find differences
+my $do_tree = 1;
+my ($count, $ins, $upt, $del, $bins, $bdel, $count1, $count2);
+
+if (defined $sample)
+{
+  $sample_seed = int(rand(1 << 31)) unless defined $sample_seed;
+  # the sampled range is derived from the seed, the global generator is kept
+  my $draw = jenkins($sample_seed & 0xffffffff, 'pg_comparator sample');
+  # whole tables unless a smaller range is selected
+  my ($lo, $hi, $ratio) = (undef, undef, 1);
+  if ($usekey)
+  {
+    # a range of the key values found on either side
+    my ($min1, $max1) = sample_bounds($dbh1, $db1, $t1, "@$k1");
+    my ($min2, $max2) = sample_bounds($dbh2, $db2, $t2, "@$k2");
+    my ($min) = sort { $a <=> $b } grep { defined } ($min1, $min2);
+    my ($max) = sort { $b <=> $a } grep { defined } ($max1, $max2);
+    if (defined $min)
+    {
+      my $width = $max - $min + 1;
+      my $nb = int($sample * $width + 0.5);
+      $nb = 1 if $nb < 1;
+      if ($nb < $width) {
+        $lo = $min + int($draw / 2**32 * ($width - $nb + 1));
+        ($hi, $ratio) = ($lo + $nb - 1, $nb / $width);
+      }
+    }
+  }
+  else
+  {
+    # there are twice as many slots over all key checksum values
+    my $nb = int($sample * (2 << $sample_bits) + 0.5);
+    $nb = 1 if $nb < 1;
+    # larger samples compare the whole tables
+    if ($nb <= (1 << $sample_bits)) {
+      my $slot = 1 << (8 * $kcs_size - 1 - $sample_bits);
+      my $start = $draw % ((1 << $sample_bits) - $nb + 1);
+      ($lo, $hi) = ($start * $slot, ($start + $nb - 1) * $slot + $slot - 1);
+      $ratio = $nb / (2 << $sample_bits);
+    }
+  }
+  verb 1, "sampling " . (defined $lo? "[$lo, $hi]": "all") .
+    " (seed=$sample_seed)...";
+  my ($kcs1, $kcs2) =
+    $usekey? ("@$k1", "@$k2"):
+    defined $key_cs? ($key_cs, $key_cs):
+      (ckatts($db1, $checksum, $kcs_size, $pk1),
+       ckatts($db2, $checksum, $kcs_size, $pk2));
+  my ($tcs1, $tcs2) =
+    defined $tup_cs? ($tup_cs, $tup_cs):
+      (ckatts($db1, $checksum, $checksize, [@$pk1, @$pc1]),
+       ckatts($db2, $checksum, $checksize, [@$pk2, @$pc2]));
+  my ($g1, $n1) = sample_fetch($dbh1, $db1,
+    sample_query($db1, $t1, $kcs1, $tcs1, $lo, $hi));
+  my ($g2, $n2) = sample_fetch($dbh2, $db2,
+    sample_query($db2, $t2, $kcs2, $tcs2, $lo, $hi));
+  my $diffs = sample_compare($g1, $g2);
+  if ($diffs) {
+    print "SAMPLE $diffs differing groups out of ", scalar(keys %$g1),
+      " and ", scalar(keys %$g2), "\n" if $report;
+  }
+  else {
+    # probability that d differing tuples all escape the sample is (1-r)**d
+    my $bound = $ratio < 1? int(log(0.05) / log(1 - $ratio)) + 1: 1;
+    printf "SAMPLE no differences in %.2f%% of %d tuples, " .
+      "less than %d differences with 95%% confidence\n",
+      100.0 * $ratio, $n1, $bound if $report;
+  }
+  if ($diffs and $escalate) {
+    verb 1, "escalating to full comparison...";
+  }
+  else {
+    ($count, $ins, $upt, $del, $bins, $bdel) = ($diffs, [], [], [], [], []);
+    ($do_join, $do_tree) = (0, 0);
+  }
+}
+
+if ($key_ranges and $do_tree)
+{
+  verb 1, "comparing key ranges...";
+  die "key-ranges option requires a scalar key, got (@$k1)" if @$k1 != 1;
+  # keys are merged as numbers by the client
+  for my $side ([$dbh1, $dhpbt1, $db1, $$k1[0]],
+                 [$dbh2, $dhpbt2, $db2, $$k2[0]])
+  {
+    my ($dbh, $dhpbt, $db, $key) = @$side;
+    my $type = col_type($dbh, $dhpbt, $db, $key);
+    die "key-ranges option requires an integer key, got $type"
+      unless $type =~ /^\s*(tiny|small|medium|big)?int(eger|[248])?\b/i;
+  }
+  dbh_materialize($dbh1, $db1);
+  dbh_materialize($dbh2, $db2);
+  range_check_version($dbh1, $db1);
+  range_check_version($dbh2, $db2);
+  ($count, $ins, $upt, $del) = range_differences(
+    [$dbh1, $db1, $t1, $$k1[0], defined $tup_cs? $tup_cs:
+       ckatts($db1, $checksum, $checksize, [@$pk1, @$pc1])],
+    [$dbh2, $db2, $t2, $$k2[0], defined $tup_cs? $tup_cs:
+       ckatts($db2, $checksum, $checksize, [@$pk2, @$pc2])]);
+  dbh_serialize($dbh1, $db1);
+  dbh_serialize($dbh2, $db2);
+  ($bins, $bdel) = ([], []);
+  $do_tree = 0;
+}
+
+if ($do_join)
+{
+  dbh_materialize($dbh1, $db1);
+  dbh_materialize($dbh2, $db2);
+  # sizes are needed for the report limit and statistics
+  if (not $size)
+  {
+    verb 1, "counting...";
+    my $s1 = count($dbh1, $db1, $t1, $where);
+    my $s2 = count($dbh2, $db2, $t2, $where);
+    if ($async) {
+      async_wait($dbh1, $db1, 'count 1');
+      async_wait($dbh2, $db2, 'count 2');
+    }
+    ($count1) = $s1->fetchrow_array();
+    ($count2) = $s2->fetchrow_array();
+    $s1->finish();
+    $s2->finish();
+  }
+
+  verb 1, "joining...";
+  my ($dbhj, $tab1, $tab2);
+  if ($db1 eq 'sqlite') {
+    # separate connection so that nothing is written to compared files
+    $dbhj = sqlite_attach($b1, $b2);
+    ($tab1, $tab2) = (sqlite_attached('pgc_1', $t1),
+                      sqlite_attached('pgc_2', $t2));
+  }
+  else {
+    # same server, the first connection can see both tables
+    $dbhj = $dbh1;
+    # wait for the transaction or lock setup, if any
+    async_wait($dbhj, $db1, 'join') if $async;
+    ($tab1, $tab2) = ($t1, $t2);
+    $tab2 = &{$M{$db2}{quote}}($b2) . ".$t2" if $b1 ne $b2;
+  }
+  eval {
+    ($count, $ins, $upt, $del) =
+      join_differences($dbhj, $db1,
+        &{$M{$db1}{join}}($dbhj, $dhpbt1,
+          $tab1, $k1,
+          defined $tup_cs? $tup_cs:
+            ckatts($db1, $checksum, $checksize, [@$pk1, @$pc1]),
+          $tab2, $k2,
+          defined $tup_cs? $tup_cs:
+            ckatts($db2, $checksum, $checksize, [@$pk2, @$pc2])));
+  };
+  my $err = $@;
+  sqlite_detach($dbhj) if $db1 eq 'sqlite';
+  dbh_serialize($dbh1, $db1);
+  dbh_serialize($dbh2, $db2);
+  die $err if $err;
+  ($bins, $bdel) = ([], []);
+  $do_tree = 0;
+}
+
+verb 1, "checksumming..." if $do_tree;
+if (not $do_tree) # differences are already known
+{
+  $count1 = $count2 = 0 unless defined $count1;
+}
+elsif ($tup_cs) # no checksum table to compute
 {
   verb 2, "using provided checksum '$tup_cs'...";
   if (not $size) # but count is needed
@@ -3444,10 +5220,11 @@ if ($tup_cs) # no checksum table to compute
     verb 2, "computing sizes...";
     die "not implemented" if $threads;
     # ELSE no thread
-    my $s1 = count($dbh1, $db1, $t1, $where);
+    my $s1 = $tree1? MemoryCursor->new([$$tree1{size}]):
+      count($dbh1, $db1, $t1, $where);
     my $s2 = count($dbh2, $db2, $t2, $where);
     if ($async) {
-      async_wait($dbh1, $db1, 'count 1');
+      async_wait($dbh1, $db1, 'count 1') unless $tree1;
       async_wait($dbh2, $db2, 'count 2');
     }
     ($count1) = $s1->fetchrow_array();
@@ -3473,16 +5250,18 @@ else # must compute checksum table
   }
   else { # no thread
     # CREATE TABLE & SELECT
-    ($count1) = build_cs_table($dbh1, $dhpbt1, $db1, $t1,
-                               $k1, $pk1, $pc1, $name1);
+    ($count1) = $tree1? $$tree1{size}:
+      build_cs_table($dbh1, $dhpbt1, $db1, $t1, $k1, $pk1, $pc1, $name1);
     ($count2) = build_cs_table($dbh2, $dhpbt2, $db2, $t2,
                                $k2, $pk2, $pc2, $name2);
     # SELECT COUNT
     if (not $size) {
       # decomposition is needed to take advantage of asynchronous queries
-      my ($s1) = start_count($dbh1, $dhpbt1, $db1, "${name1}0");
-      my ($s2) = start_count($dbh2, $dhpbt2, $db2, "${name2}0");
-      ($count1) = get_count($dbh1, $dhpbt1, $db1, $s1, $count1);
+      my ($s1, $s2);
+      ($s1) = start_count($dbh1, $dhpbt1, $db1, "${name1}0") unless $tree1;
+      ($s2) = start_count($dbh2, $dhpbt2, $db2, "${name2}0");
+      ($count1) = get_count($dbh1, $dhpbt1, $db1, $s1, $count1)
+        unless $tree1;
       ($count2) = get_count($dbh2, $dhpbt2, $db2, $s2, $count2);
     }
   }
@@ -3506,12 +5285,20 @@ die "too many differences, at least $min_diff > $max_report, " .
     "consider raising --max-ratio or --max-report"
   if defined $max_report and $min_diff>$max_report;
 
+# the join found all differences at once, but still honor the limit
+die "too many differences, $count > $max_report, " .
+    "consider raising --max-ratio or --max-report"
+  if $do_join and defined $max_report and $count>$max_report;
+
 # compute initial "full" masks which must be larger than size
 my ($mask, $nbits, @masks) = (0, 0);
 while ($mask < $size) {
   $mask = 1+($mask<<1);
   $nbits++;
 }
+warn "masks larger than the $kcs_size bytes key checksum, " .
+     "consider --key-checksum-size=8"
+  if $do_tree and not $usekey and $nbits > 8*$kcs_size;
 push @masks, $mask; # this is the full mask, which is skipped later on
 while ($mask) {
   if ($maskleft) {
@@ -3525,55 +5312,113 @@ while ($mask) {
 my $levels = @masks;
 # handle cut-off option
 splice @masks, $max_levels if $max_levels and @masks>$max_levels;
+# the imported tree summaries are built with its own masks
+@masks = @{$$tree1{masks}} if $tree1;
 verb 3, "masks=(@masks)";
 
 if ($stats) {
   # under skip async nothread, the checksum may still be underway
   if ($async and not $threads and not $size) {
-    async_wait($dbh1, $db1, 'stats 1');
+    async_wait($dbh1, $db1, 'stats 1') unless $tree1;
     async_wait($dbh2, $db2, 'stats 2');
   }
   $tcks = [gettimeofday];
 }
 # note: if stats are not required, asynchronous queries may still be underway
 
-verb 1, "building summary tables...";
-if ($threads)
+# try to find the differing buckets from one sketch of each side
+my $iblt_start;
+# buckets must be computed from the normalized key checksums
+if ($iblt and $do_tree and ($usekey or $masks[0] < 2**(8*$kcs_size)))
 {
-  $thr1 = threads->new(\&compute_summaries, $dbh1, $db1,
-                       $name1, $t1, $k1, @masks)
-    or die "cannot create thread 1-2";
-
-  $thr2 = threads->new(\&compute_summaries, $dbh2, $db2,
-                       $name2, $t2, $k2, @masks)
-    or die "cannot create thread 2-2";
-
-  $thr1->join();
-  $thr2->join();
+  verb 1, "comparing sketches...";
+  my $ncells = 3 * ($iblt + 4);
+  my ($sk1, $sk2);
+  eval {
+    $sk1 = iblt_fetch($dbh1, $db1,
+                      iblt_query($db1, $name1, $t1, $k1, $ncells));
+    $sk2 = iblt_fetch($dbh2, $db2,
+                      iblt_query($db2, $name2, $t2, $k2, $ncells));
+  };
+  if (my $err = $@)
+  {
+    # do not leave the checksum tables behind when requested to clear them
+    if ($clear) {
+      eval { table_cleanup($dbh1, $db1, $name1, 0); };
+      warn "cannot clear $name1 after sketch failure: $@" if $@;
+      eval { table_cleanup($dbh2, $db2, $name2, 0); };
+      warn "cannot clear $name2 after sketch failure: $@" if $@;
+    }
+    die $err;
+  }
+  my $items = iblt_decode($ncells, $sk1, $sk2);
+  if (defined $items)
+  {
+    my %buckets = map { ($$_[0] & $masks[0]) => 1 } @$items;
+    verb 2, "sketch decoded: " . @$items . " items in " .
+            (keys %buckets) . " buckets";
+    # no summary tables, investigate these buckets at level 0
+    splice @masks, 1;
+    $iblt_start = [$masks[0], sort { $a <=> $b } keys %buckets];
+  }
+  else {
+    verb 1, "sketch decoding failed, consider raising --iblt";
+  }
 }
-else
+
+# differences already known without the tree have no checksum tables
+if ($do_tree)
 {
-  #compute_summaries($dbh1, $db1, $name1, @masks);
-  #compute_summaries($dbh2, $db2, $name2, @masks);
-  # hmmm... possibly try to parallelize with asynchronous queries...
-  # no threads here, no need to materialize and serialize handlers
-  for my $level (1 .. @masks-1) {
-    compute_summary($dbh1, $db1, $name1, $t1, $k1, $level, @masks);
-    compute_summary($dbh2, $db2, $name2, $t2, $k2, $level, @masks);
+  verb 1, "building summary tables...";
+  if ($threads)
+  {
+    $thr1 = threads->new(\&compute_summaries, $dbh1, $db1,
+                         $name1, $t1, $k1, @masks)
+      or die "cannot create thread 1-2";
+
+    $thr2 = threads->new(\&compute_summaries, $dbh2, $db2,
+                         $name2, $t2, $k2, @masks)
+      or die "cannot create thread 2-2";
+
+    $thr1->join();
+    $thr2->join();
   }
-  if ($async) {
-    async_wait($dbh1, $db1, 'summary 1');
-    async_wait($dbh2, $db2, 'summary 2');
+  else
+  {
+    #compute_summaries($dbh1, $db1, $name1, @masks);
+    #compute_summaries($dbh2, $db2, $name2, @masks);
+    # hmmm... possibly try to parallelize with asynchronous queries...
+    # no threads here, no need to materialize and serialize handlers
+    for my $level (1 .. @masks-1) {
+      compute_summary($dbh1, $db1, $name1, $t1, $k1, $level, @masks)
+        unless $tree1;
+      compute_summary($dbh2, $db2, $name2, $t2, $k2, $level, @masks);
+    }
+    if ($async) {
+      async_wait($dbh1, $db1, 'summary 1') unless $tree1;
+      async_wait($dbh2, $db2, 'summary 2');
+    }
+  }
+
+  if (defined $export_tree)
+  {
+    dbh_materialize($dbh1, $db1);
+    tree_export($export_tree, $dbh1, $db1, $name1, $t1, $k1, $c1, $count1,
+                @masks);
+    dbh_serialize($dbh1, $db1);
   }
 }
 
 $tsum = [gettimeofday] if $stats;
 
-verb 1, "looking for differences...";
-my ($count, $ins, $upt, $del, $bins, $bdel) =
-  differences($dbh1, $dbh2, $db1, $db2, $name1, $name2,
-              $t1, $t2, $k1, $k2, @masks);
-verb 2, "differences done";
+if ($do_tree)
+{
+  verb 1, "looking for differences...";
+  ($count, $ins, $upt, $del, $bins, $bdel) =
+    differences($dbh1, $dbh2, $db1, $db2, $name1, $name2,
+                $t1, $t2, $k1, $k2, $iblt_start, @masks);
+  verb 2, "differences done";
+}
 
 $tmer = [gettimeofday] if $stats;
 
@@ -3591,24 +5436,14 @@ if ((defined $bins and @$bins) or (defined $bdel and @$bdel))
   {
     # hmmm... thread is useless if the list is empty
     $thr1 = threads->new(\&get_bulk_keys, $dbh1, $db1,
-                         # table
-                         defined $tup_cs? $t1: "${name1}0",
-                         # key checksum attribute
-                defined $key_cs? $key_cs: ($usekey and $tup_cs)? "@$k1": 'kcs',
-                         # key attribute
-                defined $tup_cs? key_pk_get(0, 0, $db1, $k1, 'AS'):
-                  $usekey? 'kcs': key_pk_get(0, 0, $db1, $k1, 'LIST'),
+                         # table, key checksum and key attributes
+                         bulk_atts($db1, $name1, $t1, $k1),
                          'INSERT', @$bins)
       or die "cannot create thread 1-3";
 
     $thr2 = threads->new(\&get_bulk_keys, $dbh2, $db2,
-                         # table
-                         defined $tup_cs? $t2: "${name2}0",
-                         # key checksum attribute
-                defined $key_cs? $key_cs: ($usekey and $tup_cs)? "@$k2": 'kcs',
-                         # key attribute
-                defined $tup_cs? key_pk_get(0, 0, $db2, $k2, 'AS'):
-                  $usekey? 'kcs': key_pk_get(0, 0, $db2, $k2, 'LIST'),
+                         # table, key checksum and key attributes
+                         bulk_atts($db2, $name2, $t2, $k2),
                          'DELETE', @$bdel)
       or die "cannot create thread 2-3";
 
@@ -3617,23 +5452,14 @@ if ((defined $bins and @$bins) or (defined $bdel and @$bdel))
   }
   else
   {
-    $insb = get_bulk_keys($dbh1, $db1,
-                          # table
-                          defined $tup_cs? $t1: "${name1}0",
-                          # key checksum attribute
-                defined $key_cs? $key_cs: ($usekey and $tup_cs)? "@$k1": 'kcs',
-                          # key attribute
-                defined $tup_cs? key_pk_get(0, 0, $db1, $k1, 'AS'):
-                  $usekey? 'kcs': key_pk_get(0, 0, $db1, $k1, 'LIST'),
-                          'INSERT', @$bins);
+    $insb = $tree1? tree_bulk_keys('INSERT', @$bins):
+      get_bulk_keys($dbh1, $db1,
+                    # table, key checksum and key attributes
+                    bulk_atts($db1, $name1, $t1, $k1),
+                    'INSERT', @$bins);
     $delb = get_bulk_keys($dbh2, $db2,
-                          # table
-                          defined $tup_cs? $t2: "${name2}0",
-                          # key checksum attribute
-                defined $key_cs? $key_cs: ($usekey and $tup_cs)? "@$k2": 'kcs',
-                          # key attribute
-                defined $tup_cs? key_pk_get(0, 0, $db2, $k2, 'AS'):
-                  $usekey? 'kcs': key_pk_get(0, 0, $db2, $k2, 'LIST'),
+                          # table, key checksum and key attributes
+                          bulk_atts($db2, $name2, $t2, $k2),
                           'DELETE', @$bdel);
   }
 
@@ -3660,7 +5486,32 @@ $tblk = [gettimeofday] if $stats;
 ############################################################### SYNCHRONIZATION
 
 # perform an actual synchronization of data
-if ($synchronize and
+if ($synchronize and $do_it and $sync_jobs > 1 and
+    # is there something to do?
+    (@$del or @$ins or @$upt or @$insb or @$delb))
+{
+  verb 1, "synchronizing with $sync_jobs jobs...";
+
+  dbh_materialize($dbh1, $db1);
+  # one connection per job, outside of any transaction
+  my @dbhs;
+  for my $i (1 .. $sync_jobs) {
+    my $dbh = conn($db2, $b2, $h2, $p2, $u2, $w2, $source2, $t2, 0);
+    $dbh->commit unless $dbh->{AutoCommit};
+    push @dbhs, $dbh;
+  }
+
+  my (@dels, @upts, @inss);
+  push @dels, (@$del, @$delb) unless $skip_deletes;
+  push @upts, @$upt unless $skip_updates;
+  push @inss, (@$ins, @$insb) unless $skip_inserts;
+  sync_parallel($dbh1, $db1, $t1, $k1, $c1, $db2, $t2, $k2, $c2,
+                \@dbhs, \@dels, \@upts, \@inss);
+
+  $_->disconnect() for @dbhs;
+  dbh_serialize($dbh1, $db1);
+}
+elsif ($synchronize and not ($do_it and $sync_jobs > 1) and
     # is there something to do?
     (@$del or @$ins or @$upt or defined $insb or defined $delb))
 {
@@ -3673,13 +5524,22 @@ if ($synchronize and
   # the synchronization is nevertheless.
   $dbh2->begin_work if $do_it and not $do_trans;
 
+  # tables are not locked with a snapshot, lock the existing rows to change,
+  # as missing rows cannot be locked
+  lock_keys($dbh2, $db2, $t2, $k2,
+            ($skip_deletes? (): (@$del, @$delb)), ($skip_updates? (): @$upt))
+    if $do_it and defined $snapshot;
+
   # build query helpers
   my $where_k1 = is_equal($dbh1, $dhpbt1, $db1, $k1);
   my $where_k2 = is_equal($dbh2, $dhpbt2, $db2, $k2);
   my $set_c2 = (join '=?, ', @$c2) . '=?';
 
+  # updates are copied unless only differing column groups are updated
+  my $copy_upt = $pg_copy && !$col_groups;
+
   # DELETE rows, including updates with copy
-  if (@$del or @$delb or ($pg_copy and @$upt))
+  if (@$del or @$delb or ($copy_upt and @$upt))
   {
     my $del_sql = "DELETE FROM $t2 WHERE " .
         ($where? "($where) AND ": '') . $where_k2;
@@ -3687,7 +5547,7 @@ if ($synchronize and
     my $del_sth = $dbh2->prepare($del_sql) if $do_it;
     my @alldels = ();
     push @alldels, (@$del, @$delb) unless $skip_deletes;
-    push @alldels, @$upt if $pg_copy and not $skip_updates;
+    push @alldels, @$upt if $copy_upt and not $skip_updates;
     for my $d (@alldels) {
       sth_param_exec($do_it, "DELETE $t2", $del_sth, $d);
     }
@@ -3696,7 +5556,8 @@ if ($synchronize and
 
   # insert/update rows
   # note: I could skip fetching if there is no data column
-  if ($pg_copy and (@$ins or @$upt or defined $insb)) { # use COPY
+  if ($pg_copy and (@$ins or ($copy_upt and @$upt) or defined $insb)) {
+    # use COPY
     sql_do($dbh2, $db2, "COPY $t2(" . join(',', @$k2, @$c2) . ") FROM STDIN");
     #async_wait($dbh2, $db2, 'copy from 2') if $async;
     my $select = "SELECT " . join(',', @$k1, @$c1) . " FROM $t1 WHERE ";
@@ -3705,12 +5566,12 @@ if ($synchronize and
     # we COPY both inserts and updates
     my @allins = ();
     push @allins, (@$ins, @$insb) unless $skip_inserts;
-    push @allins, @$upt unless $skip_updates;
+    push @allins, @$upt if $copy_upt and not $skip_updates;
     while (@allins) {
       my $bulk = '';
       for my $k (splice(@allins, 0, $pg_copy)) { # chunked
         $bulk .= ',' if $bulk;
-        $bulk .= quote_tuple(@$k);
+        $bulk .= quote_tuple($dbh1, @$k);
         $query_data++;
       }
       sql_do($dbh1, $db1, "COPY ($select$bulk)) TO STDOUT");
@@ -3732,7 +5593,7 @@ if ($synchronize and
       ($where? "($where) AND ": '') . $where_k1;
       verb 2, $val_sql;
       $val_sth = $dbh1->prepare($val_sql)
-        if @$ins or @$insb or @$upt;
+        if @$ins or @$insb or (@$upt and not $col_groups);
     }
 
     # handle inserts
@@ -3762,7 +5623,7 @@ if ($synchronize and
     }
 
     # handle updates
-    if (@$upt and not $skip_updates)
+    if (@$upt and not $skip_updates and not $col_groups)
     {
       die "there must be some columns to update" unless $c1;
       my $upt_sql = "UPDATE $t2 SET $set_c2 WHERE " .
@@ -3787,6 +5648,59 @@ if ($synchronize and
     }
   }
 
+  # handle updates of differing column groups
+  if (@$upt and not $skip_updates and $col_groups)
+  {
+    die "there must be some columns to update" unless $c1 and @$c1;
+    my @g1 = split_groups($c1);
+    my @g2 = split_groups($c2);
+    my $ng = @g1;
+    # value and update statements for each set of differing groups
+    my (%val_sths, %upt_sths, $gcs1, $gcs2);
+    for my $i (0 .. @$upt-1)
+    {
+      my $u = $$upt[$i];
+      $query_data++;
+      # get group checksums on both sides for a batch of keys
+      if ($i % $sync_batch == 0) {
+        my $last = $i + $sync_batch - 1;
+        $last = $#$upt if $last > $#$upt;
+        my @batch = @$upt[$i .. $last];
+        $gcs1 = gcs_fetch($dbh1, $dhpbt1, $db1, $name1, $k1, $ng, @batch);
+        $gcs2 = gcs_fetch($dbh2, $dhpbt2, $db2, $name2, $k2, $ng, @batch);
+      }
+      my @gcs1 = gcs_lookup($gcs1, $dbh1, $dhpbt1, $db1, $name1, $k1, $ng, $u);
+      my @gcs2 = gcs_lookup($gcs2, $dbh2, $dhpbt2, $db2, $name2, $k2, $ng, $u);
+      die "unexpected group checksums fetched for update"
+        unless @gcs1 == @g1 and @gcs2 == @g1;
+      my @diff = grep { $gcs1[$_] ne $gcs2[$_] } 0 .. $#g1;
+      # the tuple checksum differs but no group does: update all columns
+      @diff = (0 .. $#g1) unless @diff;
+      my $groups = "@diff";
+      my @cols1 = map { @{$g1[$_]} } @diff;
+      my @cols2 = map { @{$g2[$_]} } @diff;
+      if (not exists $val_sths{$groups}) {
+        my $val_sql = "SELECT " . join(',', @cols1) . " FROM $t1 WHERE " .
+          ($where? "($where) AND ": '') . $where_k1;
+        verb 2, $val_sql;
+        $val_sths{$groups} = $dbh1->prepare($val_sql);
+        my $upt_sql = "UPDATE $t2 SET " . (join '=?, ', @cols2) . '=? ' .
+          "WHERE " . ($where? "($where) AND ": '') . $where_k2;
+        verb 2, $upt_sql;
+        $upt_sths{$groups} = $dbh2->prepare($upt_sql) if $do_it;
+      }
+      # get values of differing groups for key $u
+      my $val_sth = $val_sths{$groups};
+      sth_param_exec(1, "SELECT $t1", $val_sth, $u);
+      my @c1values = $val_sth->fetchrow_array();
+      die "unexpected values fetched for update"
+        unless @c1values and @c1values == @cols1;
+      # use it to update the other table
+      sth_param_exec($do_it, "UPDATE $t2", $upt_sths{$groups}, $u, @c1values);
+      &{$M{$db1}{close_cursor}}($val_sth) if exists $M{$db1}{close_cursor};
+    }
+  }
+
   # close synchronization transaction if any
   $dbh2->commit if $do_it and not $do_trans;
 
@@ -3807,7 +5721,7 @@ if ($synchronize and
 
 $tsyn = [gettimeofday] if $stats;
 
-if ($clear)
+if ($clear and $do_tree)
 {
   verb 4, "clearing...";
   my $levels = @masks - 1;
@@ -3822,7 +5736,7 @@ if ($clear)
   }
   else
   {
-    table_cleanup($dbh1, $db1, $name1, $levels);
+    table_cleanup($dbh1, $db1, $name1, $levels) unless $tree1;
     table_cleanup($dbh2, $db2, $name2, $levels);
   }
   verb 4, "clearing done."
@@ -3837,7 +5751,7 @@ dbh_materialize($dbh2, $db2);
 # unlock for mysql
 if ($do_lock)
 {
-  if ($db1 eq 'mysql') {
+  if ($db1 eq 'mysql' and not $tree1) {
     sql_do($dbh1, $db1, "UNLOCK TABLES");
     async_wait($dbh1, $db1, 'unlock 1') if $async;
   }
@@ -3850,7 +5764,7 @@ if ($do_lock)
 # end of the big transactions...
 if ($do_trans)
 {
-  $dbh1->commit or die $dbh1->errstr;
+  $dbh1->commit or die $dbh1->errstr unless $tree1;
   $dbh2->commit or die $dbh2->errstr;
 }
 
@@ -3860,10 +5774,14 @@ $tend = [gettimeofday] if $stats;
 # some stats are collected out of time measures
 if ($stats)
 {
-  my $tk1 = subs_null(&{$M{$db1}{null}}('text', 0, 0), $dbh1, $dhpbt1, $k1);
-  $key_size = col_size($dbh1, $db1, $t1, $tk1);
-  $col_size = col_size($dbh1, $db1, $t1,
-                       [subs(&{$M{$db1}{null}}('text', 0, 0), @$c1)]);
+  # measured on the second table if the first one is an imported tree
+  my ($dbh, $db, $dhpbt, $t, $k, $c) = $tree1?
+    ($dbh2, $db2, $dhpbt2, $t2, $k2, $c2):
+    ($dbh1, $db1, $dhpbt1, $t1, $k1, $c1);
+  my $tk = subs_null(&{$M{$db}{null}}('text', 0, 0), $dbh, $dhpbt, $k);
+  $key_size = col_size($dbh, $db, $t, $tk);
+  $col_size = col_size($dbh, $db, $t,
+                       [subs(&{$M{$db}{null}}('text', 0, 0), @$c)]);
 }
 
 # final stuff:
@@ -3873,7 +5791,7 @@ if ($stats)
 # @$del @$delb: key delete (ind & bulks)
 
 # close both connections
-$dbh1->disconnect() or warn $dbh1->errstr;
+$dbh1->disconnect() or warn $dbh1->errstr unless $tree1;
 $dbh2->disconnect() or warn $dbh2->errstr;
 
 #################################################################### STATISTICS
@@ -3892,6 +5810,16 @@ if (defined $stats)
 
   # build options as a bit vector
   my $options =
+      ((defined $export_tree || defined $import_tree) << 19) | # --*-tree=...
+      ((defined $snapshot) << 21) | # --snapshot
+      (($sync_jobs>1?1:0) << 20) | # --sync-jobs=...
+      (($iblt?1:0) << 18) |     # --iblt=...
+      ($slim << 17) |           # --slim
+      ($key_ranges << 16) |     # --key-ranges
+      (($col_groups?1:0) << 15) | # --column-groups=...
+      ((defined $sample?1:0) << 14) | # --sample=...
+      (($kcs_size==8?1:0) << 13) | # --key-checksum-size=8
+      (($do_join?1:0) << 12) |  # --join
       (($pg_copy?1:0) << 11) |  # --pg-copy=...
       (($tup_cs?1:0) << 10) |   # --tuple-checksum=...
       (($key_cs?1:0) << 9) |    # --key-checksum=...
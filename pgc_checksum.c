@@ -136,3 +136,65 @@ Datum text_fnv8(PG_FUNCTION_ARGS)
   }
   PG_RETURN_INT64(fnv_int8(data, size));
 }
+
+/* MD5-based checksums
+ */
+extern Datum text_md5_2(PG_FUNCTION_ARGS);
+extern Datum text_md5_4(PG_FUNCTION_ARGS);
+extern Datum text_md5_8(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(text_md5_2);
+PG_FUNCTION_INFO_V1(text_md5_4);
+PG_FUNCTION_INFO_V1(text_md5_8);
+
+#include "md5.c"
+
+Datum text_md5_2(PG_FUNCTION_ARGS)
+{
+  unsigned char * data;
+  size_t size;
+  if (PG_ARGISNULL(0))
+  {
+    data = NULL, size = 0;
+  }
+  else
+  {
+    text *t = PG_GETARG_TEXT_P(0);
+    size = VARSIZE(t) - VARHDRSZ;
+    data = (unsigned char *) VARDATA(t);
+  }
+  PG_RETURN_INT16(md5_int2(data, size));
+}
+
+Datum text_md5_4(PG_FUNCTION_ARGS)
+{
+  unsigned char * data;
+  size_t size;
+  if (PG_ARGISNULL(0))
+  {
+    data = NULL, size = 0;
+  }
+  else
+  {
+    text *t = PG_GETARG_TEXT_P(0);
+    size = VARSIZE(t) - VARHDRSZ;
+    data = (unsigned char *) VARDATA(t);
+  }
+  PG_RETURN_INT32(md5_int4(data, size));
+}
+
+Datum text_md5_8(PG_FUNCTION_ARGS)
+{
+  unsigned char * data;
+  size_t size;
+  if (PG_ARGISNULL(0))
+  {
+    data = NULL, size = 0;
+  }
+  else
+  {
+    text *t = PG_GETARG_TEXT_P(0);
+    size = VARSIZE(t) - VARHDRSZ;
+    data = (unsigned char *) VARDATA(t);
+  }
+  PG_RETURN_INT64(md5_int8(data, size));
+}
@@ -0,0 +1,56 @@
+/* $Id$
+ *
+ * Invertible Bloom lookup table aggregate for pg_comparator,
+ * see "iblt.c" for the sketch layout.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#ifdef PG_MODULE_MAGIC
+PG_MODULE_MAGIC;
+#endif
+
+extern Datum pgc_iblt_step(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pgc_iblt_step);
+
+// jenkins.c is already included by pgc_checksum.c
+#include "iblt.c"
+
+/* iblt_step(state BYTEA, ncells INT4, kcs INT8, tcs INT8) RETURNS BYTEA
+ * the state is allocated once in the aggregate context and updated in place.
+ * NULL items are ignored.
+ */
+Datum pgc_iblt_step(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggcontext;
+  bytea * state;
+  size_t ncells;
+
+  if (!AggCheckCallContext(fcinfo, &aggcontext))
+    elog(ERROR, "iblt_step called in non-aggregate context");
+
+  if (PG_ARGISNULL(1))
+    elog(ERROR, "iblt number of cells must not be NULL");
+
+  ncells = iblt_cells(PG_GETARG_INT32(1));
+
+  if (PG_ARGISNULL(0))
+  {
+    size_t size = VARHDRSZ + IBLT_CELL_SIZE * ncells;
+    state = (bytea *) MemoryContextAllocZero(aggcontext, size);
+    SET_VARSIZE(state, size);
+  }
+  else
+  {
+    state = PG_GETARG_BYTEA_P(0);
+    if (VARSIZE(state) - VARHDRSZ != IBLT_CELL_SIZE * ncells)
+      elog(ERROR, "iblt number of cells must not change");
+  }
+
+  if (!PG_ARGISNULL(2) && !PG_ARGISNULL(3))
+    iblt_insert((unsigned char *) VARDATA(state), ncells,
+                PG_GETARG_INT64(2), PG_GETARG_INT64(3), 1);
+
+  PG_RETURN_BYTEA_P(state);
+}
@@ -0,0 +1,44 @@
+--
+-- $Id$
+--
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION pgcmp UPDATE TO '3.2'" to load this file. \quit
+
+--
+-- CHECKSUMS
+--
+
+CREATE OR REPLACE FUNCTION md5_2(TEXT)
+RETURNS INT2
+LANGUAGE C
+CALLED ON NULL INPUT
+AS 'MODULE_PATHNAME', 'text_md5_2';
+
+CREATE OR REPLACE FUNCTION md5_4(TEXT)
+RETURNS INT4
+LANGUAGE C
+CALLED ON NULL INPUT
+AS 'MODULE_PATHNAME', 'text_md5_4';
+
+CREATE OR REPLACE FUNCTION md5_8(TEXT)
+RETURNS INT8
+LANGUAGE C
+CALLED ON NULL INPUT
+AS 'MODULE_PATHNAME', 'text_md5_8';
+
+--
+-- INVERTIBLE BLOOM LOOKUP TABLE
+--
+
+CREATE OR REPLACE FUNCTION iblt_step(BYTEA, INT4, INT8, INT8)
+RETURNS BYTEA
+LANGUAGE C
+CALLED ON NULL INPUT
+AS 'MODULE_PATHNAME', 'pgc_iblt_step';
+
+-- IBLT(ncells, kcs, tcs)
+CREATE AGGREGATE IBLT(INT4, INT8, INT8) (
+  SFUNC = iblt_step,
+  STYPE = BYTEA
+);
@@ -152,3 +152,38 @@ RETURNS INT8
 LANGUAGE C
 CALLED ON NULL INPUT
 AS 'MODULE_PATHNAME', 'text_fnv8';
+
+CREATE OR REPLACE FUNCTION md5_2(TEXT)
+RETURNS INT2
+LANGUAGE C
+CALLED ON NULL INPUT
+AS 'MODULE_PATHNAME', 'text_md5_2';
+
+CREATE OR REPLACE FUNCTION md5_4(TEXT)
+RETURNS INT4
+LANGUAGE C
+CALLED ON NULL INPUT
+AS 'MODULE_PATHNAME', 'text_md5_4';
+
+CREATE OR REPLACE FUNCTION md5_8(TEXT)
+RETURNS INT8
+LANGUAGE C
+CALLED ON NULL INPUT
+AS 'MODULE_PATHNAME', 'text_md5_8';
+
+--
+-- INVERTIBLE BLOOM LOOKUP TABLE
+--
+
+CREATE OR REPLACE FUNCTION iblt_step(BYTEA, INT4, INT8, INT8)
+RETURNS BYTEA
+LANGUAGE C
+CALLED ON NULL INPUT
+AS 'MODULE_PATHNAME', 'pgc_iblt_step';
+
+-- IBLT(ncells, kcs, tcs)
+DROP AGGREGATE IF EXISTS IBLT(INT4, INT8, INT8);
+CREATE AGGREGATE IBLT(INT4, INT8, INT8) (
+  SFUNC = iblt_step,
+  STYPE = BYTEA
+);
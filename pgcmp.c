@@ -2,3 +2,4 @@
 #include "pgc_casts.c"
 #undef PG_MODULE_MAGIC
 #include "pgc_checksum.c"
+#include "pgc_iblt.c"
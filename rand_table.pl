@@ -17,6 +17,7 @@ my $width = 1;       # add 18 chars per width
 my $key = 0;         # starting id
 my $null = 1;        # declare elements as nullable
 my $nullkey = 0;     # allow null keys
+my $partitions = 0;  # number of hash partitions, pgsql only
 my $create = 1;      # whether to create the table
 my $db = 'pgsql';    # target database: pgsql mysql sqlite firebird
 my $transaction = 0; # whether to wrap in a transaction
@@ -34,6 +35,7 @@ GetOptions(
   "null-key|nk!" => \$nullkey,
   "start-key|start|sk|K=i" => \$key,
   "transaction|T!" => \$transaction,
+  "partitions|p=i" => \$partitions,
   # target databases
   "mysql" => sub { $db = 'mysql'; },
   "pgsql" => sub { $db = 'pgsql'; },
@@ -64,6 +66,9 @@ die "--*-checksum options work only for pgsql"
 die "engine option only valid under mysql"
   if defined $engine and $db ne 'mysql';
 
+die "partitions option only valid under pgsql"
+  if $partitions and $db ne 'pgsql';
+
 # force commit...
 $transaction = 1 if $db eq 'firebird';
 
@@ -133,7 +138,14 @@ if ($create)
   # PRIMARY KEY implies NOT NULL, but UNIQUE does not
   print
       ",\n  ", $nullkey? 'UNIQUE': 'PRIMARY KEY', " (",
-      join(',', 'id', @keys), ")\n)", $engine? "ENGINE $engine": '', ";\n";
+      join(',', 'id', @keys), ")\n)", $engine? "ENGINE $engine": '',
+      $partitions? " PARTITION BY HASH (id)": '', ";\n";
+
+  # hash partitions, so that rows are spread over several relations
+  for my $i (0 .. $partitions-1) {
+    print "CREATE TABLE ${table}_p$i PARTITION OF $table\n",
+      "  FOR VALUES WITH (MODULUS $partitions, REMAINDER $i);\n";
+  }
 
   # checksum triggers, should be a single trigger.
   column_checksum('key', $key_cs, 4, @keys) if $key_cs;
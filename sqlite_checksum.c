@@ -3,7 +3,10 @@
  * SQLite extensions for pg_comparator.
  *
  * provide checksum functions: cksum2, cksum4 and cksum8.
+ * provide md5 checksum functions: md5_2, md5_4 and md5_8.
  * provide integer aggregates: xor and isum.
+ * provide merge aggregate: pgc_diff.
+ * provide sketch aggregate: iblt.
  */
 
 #include <stdio.h>
@@ -21,6 +24,7 @@ SQLITE_EXTENSION_INIT1
 
 // plain C implementations
 #include "jenkins.c"
+#include "md5.c"
 
 /******************************************************* CHECKSUMS FUNCTIONS */
 
@@ -192,6 +196,91 @@ static void sqlite_fnv_int8(
   sqlite3_result_int64(ctx, checksum_int8(txt, len));
 }
 
+
+static void sqlite_md5_int2(
+  sqlite3_context * ctx,
+  int argc,
+  sqlite3_value ** argv)
+{
+  assert(argc==1);
+  const unsigned char * txt;
+  size_t len;
+  switch (sqlite3_value_type(argv[0])) {
+  case SQLITE_NULL:
+    txt = NULL;
+    len = 0;
+    break;
+  case SQLITE_TEXT:
+    txt = sqlite3_value_text(argv[0]);
+    len = sqlite3_value_bytes(argv[0]);
+    break;
+    // hmmm... should I do something else?
+  case SQLITE_INTEGER:
+  case SQLITE_FLOAT:
+  case SQLITE_BLOB:
+  default:
+    sqlite3_result_error(ctx, "expecting TEXT or NULL", -1);
+    return;
+  }
+  sqlite3_result_int(ctx, md5_int2(txt, len));
+}
+
+static void sqlite_md5_int4(
+  sqlite3_context * ctx,
+  int argc,
+  sqlite3_value ** argv)
+{
+  assert(argc==1);
+  const unsigned char * txt;
+  size_t len;
+  switch (sqlite3_value_type(argv[0])) {
+  case SQLITE_NULL:
+    txt = NULL;
+    len = 0;
+    break;
+  case SQLITE_TEXT:
+    txt = sqlite3_value_text(argv[0]);
+    len = sqlite3_value_bytes(argv[0]);
+    break;
+    // hmmm... should I do something else?
+  case SQLITE_INTEGER:
+  case SQLITE_FLOAT:
+  case SQLITE_BLOB:
+  default:
+    sqlite3_result_error(ctx, "expecting TEXT or NULL", -1);
+    return;
+  }
+  sqlite3_result_int(ctx, md5_int4(txt, len));
+}
+
+static void sqlite_md5_int8(
+  sqlite3_context * ctx,
+  int argc,
+  sqlite3_value ** argv)
+{
+  assert(argc==1);
+  const unsigned char * txt;
+  size_t len;
+  switch (sqlite3_value_type(argv[0])) {
+  case SQLITE_NULL:
+    txt = NULL;
+    len = 0;
+    break;
+  case SQLITE_TEXT:
+    txt = sqlite3_value_text(argv[0]);
+    len = sqlite3_value_bytes(argv[0]);
+    break;
+    // hmmm... should I do something else?
+  case SQLITE_INTEGER:
+  case SQLITE_FLOAT:
+  case SQLITE_BLOB:
+  default:
+    sqlite3_result_error(ctx, "expecting TEXT or NULL", -1);
+    return;
+  }
+  sqlite3_result_int64(ctx, md5_int8(txt, len));
+}
+
 /***************************************************** INTEGER XOR AGGREGATE */
 
 static void ixor_step(
@@ -225,6 +314,116 @@ static void int_finalize(sqlite3_context * ctx)
   sqlite3_result_int64(ctx, val? *val: 0);
 }
 
+/*********************************************************** MERGE AGGREGATE */
+
+/* merge state for one key: tuple checksums xor and counts for both sides.
+ * this allows to compare two attached databases in a single pass:
+ *
+ *   SELECT PGC_DIFF(side, tcs) AS op, key FROM (
+ *     SELECT 1 AS side, tcs, key FROM one.table UNION ALL
+ *     SELECT 2 AS side, tcs, key FROM two.table)
+ *   GROUP BY key HAVING op IS NOT NULL;
+ */
+typedef struct {
+  int64_t tcs[2];
+  int64_t count[2];
+} merge_t;
+
+static void merge_step(
+  sqlite3_context * ctx,
+  int argc,
+  sqlite3_value ** argv)
+{
+  assert(argc==2);
+  merge_t * m = sqlite3_aggregate_context(ctx, sizeof(merge_t));
+  int side = sqlite3_value_int(argv[0]);
+  if (m && (side==1 || side==2)) {
+    m->tcs[side-1] ^= sqlite3_value_int64(argv[1]);
+    m->count[side-1]++;
+  }
+  // else just ignore...
+}
+
+// tell what to do on the second side: INSERT, UPDATE, DELETE or NULL
+static void merge_finalize(sqlite3_context * ctx)
+{
+  merge_t * m = sqlite3_aggregate_context(ctx, 0);
+  if (!m)
+    sqlite3_result_null(ctx);
+  else if (!m->count[1])
+    sqlite3_result_text(ctx, "INSERT", -1, SQLITE_STATIC);
+  else if (!m->count[0])
+    sqlite3_result_text(ctx, "DELETE", -1, SQLITE_STATIC);
+  else if (m->count[0]!=m->count[1] || m->tcs[0]!=m->tcs[1])
+    sqlite3_result_text(ctx, "UPDATE", -1, SQLITE_STATIC);
+  else // same contents
+    sqlite3_result_null(ctx);
+}
+
+/************************************************************ IBLT AGGREGATE */
+
+#include "iblt.c"
+
+typedef struct {
+  size_t ncells;
+  unsigned char * table;
+  int failed;
+} iblt_t;
+
+static void iblt_fail(sqlite3_context * ctx, iblt_t * s, const char * msg)
+{
+  // release the table now, as the finalizer only sees an error
+  sqlite3_free(s->table);
+  s->table = NULL;
+  s->failed = 1;
+  if (msg)
+    sqlite3_result_error(ctx, msg, -1);
+  else
+    sqlite3_result_error_nomem(ctx);
+}
+
+// iblt(ncells, kcs, tcs)
+static void sqlite_iblt_step(
+  sqlite3_context * ctx,
+  int argc,
+  sqlite3_value ** argv)
+{
+  assert(argc==3);
+  iblt_t * s = sqlite3_aggregate_context(ctx, sizeof(iblt_t));
+  if (!s || s->failed)
+    return;
+  if (!s->table) {
+    s->ncells = iblt_cells(sqlite3_value_int64(argv[0]));
+    s->table = sqlite3_malloc(IBLT_CELL_SIZE * s->ncells);
+    if (!s->table) {
+      iblt_fail(ctx, s, NULL);
+      return;
+    }
+    memset(s->table, 0, IBLT_CELL_SIZE * s->ncells);
+  }
+  else if (iblt_cells(sqlite3_value_int64(argv[0])) != s->ncells) {
+    iblt_fail(ctx, s, "iblt number of cells must be constant");
+    return;
+  }
+  // NULL items are ignored
+  if (sqlite3_value_type(argv[1])!=SQLITE_NULL &&
+      sqlite3_value_type(argv[2])!=SQLITE_NULL)
+    iblt_insert(s->table, s->ncells,
+                sqlite3_value_int64(argv[1]), sqlite3_value_int64(argv[2]), 1);
+}
+
+static void sqlite_iblt_finalize(sqlite3_context * ctx)
+{
+  iblt_t * s = sqlite3_aggregate_context(ctx, 0);
+  if (s && s->failed)
+    sqlite3_result_error(ctx, "iblt aggregate failed", -1);
+  else if (!s || !s->table)
+    sqlite3_result_null(ctx);
+  else // the blob takes ownership of the table
+    sqlite3_result_blob(ctx, s->table, IBLT_CELL_SIZE * s->ncells,
+                        sqlite3_free);
+}
+
 /***************************************************************** AUTO LOAD */
 
 #ifdef COMPILE_SQLITE_EXTENSIONS_AS_LOADABLE_MODULE
@@ -272,6 +471,24 @@ int sqlite3_extension_init(
 			  // func, step, final
 			  sqlite_fnv_int8, NULL, NULL);
 
+  sqlite3_create_function(db,
+			  // name, #arg, txt, data,
+			  "md5_2", 1, SQLITE_UTF8, NULL,
+			  // func, step, final
+			  sqlite_md5_int2, NULL, NULL);
+
+  sqlite3_create_function(db,
+			  // name, #arg, txt, data,
+			  "md5_4", 1, SQLITE_UTF8, NULL,
+			  // func, step, final
+			  sqlite_md5_int4, NULL, NULL);
+
+  sqlite3_create_function(db,
+			  // name, #arg, txt, data,
+			  "md5_8", 1, SQLITE_UTF8, NULL,
+			  // func, step, final
+			  sqlite_md5_int8, NULL, NULL);
+
   sqlite3_create_function(db,
         // name, #args, txt, data,
         "xor", 1, SQLITE_UTF8, NULL,
@@ -284,6 +501,18 @@ int sqlite3_extension_init(
         // func, step, final
         NULL, isum_step, int_finalize);
 
+  sqlite3_create_function(db,
+        // name, #args, txt, data,
+        "pgc_diff", 2, SQLITE_UTF8, NULL,
+        // func, step, final
+        NULL, merge_step, merge_finalize);
+
+  sqlite3_create_function(db,
+        // name, #args, txt, data,
+        "iblt", 3, SQLITE_UTF8, NULL,
+        // func, step, final
+        NULL, sqlite_iblt_step, sqlite_iblt_finalize);
+
  return 0;
 }
 #endif // COMPILE_SQLITE_EXTENSIONS_AS_LOADABLE_MODULE
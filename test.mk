@@ -95,6 +95,7 @@ LOG	= .log
 
 #
 # test generation, then comparison & synchronization & check
+# the checksum tree algorithm is used unless --join is in pgcopts
 #
 # make AUTH=calvin:hobbes@home DB=calvin COLS=0 ROWS=1000 run
 .PHONY: run
@@ -108,20 +109,58 @@ run: pg_comparator
 	  -t $(TOTAL) -e $(ENGINE) $(RUNOPS) $(crtopts) $(CRTOPTS)
 	$(PG_PRE)
 	time ./pg_comparator -f $(FOLD) --cf=$(CF) -a $(AGG) --cs=$(CS) \
-	    --null=$(NULL) -e $(TOTAL) --no-report $(pgcopts) $(PGCOPTS) \
-		'$(CONN1)' '$(CONN2)'
+	    --null=$(NULL) -e $(TOTAL) --no-report --no-join $(pgcopts) \
+	    $(PGCOPTS) '$(CONN1)' '$(CONN2)'
 	time ./pg_comparator -S -D -f $(FOLD) --cf=$(CF) -a $(AGG) --cs=$(CS) \
-	    --null=$(NULL) -e $(TOTAL) --no-report $(pgcopts) $(PGCOPTS) \
-		'$(CONN1)' '$(CONN2)'
+	    --null=$(NULL) -e $(TOTAL) --no-report --no-join $(pgcopts) \
+	    $(PGCOPTS) '$(CONN1)' '$(CONN2)'
 	time ./pg_comparator -f $(FOLD) --cf=$(CF) -a $(AGG) --cs=$(CS) \
-	    --null=$(NULL) -e 0 --no-report $(pgcopts) $(PGCOPTS) \
+	    --null=$(NULL) -e 0 --no-report --no-join $(pgcopts) $(PGCOPTS) \
 		'$(CONN1)' '$(CONN2)'
 	$(PG_POST)
 
+# comparison against an exported tree of the first table, which is
+# then used instead of the first connection
+TREE	= pgc_tree.bin
+.PHONY: run_tree
+run_tree: pg_comparator
+	./test_pg_comparator.sh \
+	  -1 $(AUTH1) -2 $(AUTH2) -b1 $(DB1) -b2 $(DB2) \
+	  -k $(KEYS) -c $(COLS) -r $(ROWS) -w $(WIDTH) \
+	  -t $(TOTAL) -e $(ENGINE) $(RUNOPS) $(crtopts) $(CRTOPTS)
+	time ./pg_comparator -f $(FOLD) --cf=$(CF) -a $(AGG) --cs=$(CS) \
+	    --null=$(NULL) -e $(TOTAL) --no-report --export-tree=$(TREE) \
+	    $(pgcopts) $(PGCOPTS) '$(CONN1)' '$(CONN2)'
+	time ./pg_comparator -f $(FOLD) --cf=$(CF) -a $(AGG) --cs=$(CS) \
+	    --null=$(NULL) -e $(TOTAL) --no-report --import-tree=$(TREE) \
+	    $(pgcopts) $(PGCOPTS) '$(CONN1)' '$(CONN2)'
+	$(RM) $(TREE)
+
+# sampled check without escalation: differing groups are reported on
+# modified tables, and a 95% confidence bound on identical ones, which is
+# 11 differences for a quarter of the tuples.
+.PHONY: run_sample
+run_sample: pg_comparator
+	./test_pg_comparator.sh \
+	  -1 $(AUTH1) -2 $(AUTH2) -b1 $(DB1) -b2 $(DB2) \
+	  -k $(KEYS) -c $(COLS) -r $(ROWS) -w $(WIDTH) \
+	  -t $(TOTAL) -e $(ENGINE) $(RUNOPS) $(crtopts) $(CRTOPTS)
+	./pg_comparator --cf=$(CF) -a $(AGG) --cs=$(CS) --null=$(NULL) \
+	    --sample=1 $(pgcopts) $(PGCOPTS) '$(CONN1)' '$(CONN2)' | \
+	  grep '^SAMPLE [1-9][0-9]* differing groups out of '
+	./test_pg_comparator.sh \
+	  -1 $(AUTH1) -2 $(AUTH2) -b1 $(DB1) -b2 $(DB2) \
+	  -k $(KEYS) -c $(COLS) -r $(ROWS) -w $(WIDTH) \
+	  -t $(TOTAL) -e $(ENGINE) -C -K $(crtopts) $(CRTOPTS)
+	./pg_comparator --cf=$(CF) -a $(AGG) --cs=$(CS) --null=$(NULL) \
+	    --sample=0.25 --sample-seed=1 $(pgcopts) $(PGCOPTS) \
+	    '$(CONN1)' '$(CONN2)' | \
+	  grep '^SAMPLE no differences in 25.00% of [0-9]* tuples, less than 11 differences with 95% confidence$$'
+
 .PHONY: clean-test
 clean: clean-test
 clean-test:
-	$(RM) $(LOG)
+	$(RM) $(LOG) $(TREE)
 
 ########################################################################## FULL
 #
@@ -185,7 +224,7 @@ full_mix: full_sizes
 
 ########################################################################## FAST
 #
-# FAST TESTS: 12 tests, just a subset of combinations
+# FAST TESTS: 14 tests, just a subset of combinations
 # run is 3 calls to pg_comparator: compare, sync, check sync
 # xor tests are skipped when databases are mixed.
 # also tests some options here and there...
@@ -195,6 +234,7 @@ fast:
 	$(MAKE) CF=$(md5) CS=8 AGG=$(sum) NULL=$(text) FOLD=1 KEYS=0 COLS=0 run
 	$(MAKE) CF=$(ck)  CS=8 AGG=$(sum) NULL=$(text) FOLD=2 KEYS=0 COLS=1 pgcopts+=' -u' run
 	$(MAKE) CF=$(md5) CS=8 AGG=$(xor) NULL=$(hash) FOLD=1 KEYS=0 COLS=1 run
+	$(MAKE) CF=$(md5) CS=8 AGG=$(xor) NULL=$(hash) FOLD=1 KEYS=0 COLS=1 pgcopts+=' --kcs-size=8' run
 	$(MAKE) CF=$(md5) CS=8 AGG=$(sum) NULL=$(text) FOLD=1 KEYS=1 COLS=2 pgcopts+=' --max-levels=3' run
 	$(MAKE) CF=$(fnv) CS=4 AGG=$(sum) NULL=$(hash) FOLD=3 KEYS=0 COLS=2 pgcopts+=' --lock' run
 	$(MAKE) CF=$(ck)  CS=8 AGG=$(sum) NULL=$(text) FOLD=2 KEYS=0 COLS=1 pgcopts+=' --cc=insert' run
@@ -204,6 +244,7 @@ fast:
 	$(MAKE) CF=$(ck)  CS=4 AGG=$(xor) NULL=$(hash) FOLD=7 KEYS=2 COLS=3 pgcopts+=' --no-temporary --unlogged --cleanup' run
 	$(MAKE) CF=$(ck)  CS=8 AGG=$(xor) NULL=$(text) FOLD=6 KEYS=1 COLS=2 pgcopts+=' --no-temporary --cleanup' run
 	$(MAKE) CF=$(ck)  CS=8 AGG=$(xor) NULL=$(hash) FOLD=8 KEYS=2 COLS=3 run
+	$(MAKE) CF=$(ck)  CS=8 AGG=$(xor) NULL=$(hash) FOLD=8 KEYS=2 COLS=3 pgcopts+=' --column-groups=2' run
 
 # this is scripted rather than relying on dependencies
 # so that error messages are clearer
@@ -303,10 +344,10 @@ validate_sanity:
 # - TOTAL=8 ROWS=10000 ~ 10 minutes
 # - TOTAL=100 ROWS=10000 ~ 10 minutes
 # - TOTAL=500 ROWS=10000 ~ 11 minutes
-#    pg: 3 * 12 * 2
-#    my: 3 * 12 * 4 # hmmm, seems slow...
-#   mix: 3 * 12 * 4
-# total: 72 + 144 + 144 = 360
+#    pg: 3 * 14 * 2
+#    my: 3 * 14 * 4 # hmmm, seems slow...
+#   mix: 3 * 14 * 4
+# total: 84 + 168 + 168 = 420
 .PHONY: validate_fast
 validate_fast:
 	@echo "# $@ start"
@@ -351,6 +392,14 @@ validate_feature:
 	$(MAKE) validate_auto # pgsql only
 	$(MAKE) validate_empty
 	$(MAKE) validate_pgcopy # pgsql only
+	$(MAKE) validate_join
+	$(MAKE) validate_sample
+	$(MAKE) validate_ranges
+	$(MAKE) validate_slim
+	$(MAKE) validate_iblt
+	$(MAKE) validate_tree
+	$(MAKE) validate_sync_jobs
+	$(MAKE) validate_snapshot
 	[ $(ROWS) = 10 ] && $(MAKE) validate_quote || exit 0
 	[ $(ROWS) = 10 ] && $(MAKE) validate_sqlite || exit 0 # sqlite only
 	[ $(ROWS) = 10 ] && $(MAKE) validate_mylite || exit 0 # partial
@@ -406,6 +455,112 @@ validate_pgcopy:
 	@echo "# $@ start"
 	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) \
 	  pgcopts+='--pg-copy --no-async' sanity_pg
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) COLS=3 \
+	  pgcopts+='--pg-copy --no-async --column-groups=3' sanity_pg
+	@echo "# $@ done"
+
+# single query comparison on the same server, also when synchronizing
+# 4*3 = 12 runs
+.PHONY: validate_join
+validate_join:
+	@echo "# $@ start"
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) pgcopts+=' --join --no-lock' sanity_pg
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) pgcopts+=' --no-join' sanity_pg
+	$(MAKE) AUTH1=$(auth2) AUTH2=$(auth2) pgcopts+=' --join --no-lock' sanity_my
+	$(MAKE) AUTH1=$(auth2) AUTH2=$(auth2) pgcopts+=' --no-join' sanity_my
+	@echo "# $@ done"
+
+# full sample escalates to the comparison when there are differences,
+# and reports without escalating, also with a given size
+# 2*3 + 4*2 = 14 runs
+.PHONY: validate_sample
+validate_sample:
+	@echo "# $@ start"
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth2) xor=sum \
+	  pgcopts+=' --sample=1 --escalate' sanity_mix
+	$(MAKE) AUTH1=$(auth2) AUTH2=$(auth1) xor=sum \
+	  pgcopts+=' --sample=1 --escalate --sample-seed=1' sanity_mix
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) run_sample
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth2) run_sample
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) pgcopts+=' --size=$(ROWS)' run_sample
+	PGC_SQLITE_LOAD_EXTENSION=/usr/local/lib/sqlite_checksum.so \
+	  $(MAKE) AUTH1=$(auth3) AUTH2=$(auth3) DB=base.db run_sample
+	@echo "# $@ done"
+
+# key range tree instead of checksum buckets, also with a given size
+# 4*3 = 12 runs
+.PHONY: validate_ranges
+validate_ranges:
+	@echo "# $@ start"
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) pgcopts+=' --key-ranges' sanity_pg
+	$(MAKE) AUTH1=$(auth2) AUTH2=$(auth2) pgcopts+=' --key-ranges' sanity_my
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth2) xor=sum \
+	  pgcopts+=' --key-ranges' sanity_mix
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) \
+	  pgcopts+=' --key-ranges --size=$(ROWS)' sanity_pg
+	@echo "# $@ done"
+
+# row locator instead of keys in the checksum table, also on partitions
+# 3*3 = 9 runs
+.PHONY: validate_slim
+validate_slim:
+	@echo "# $@ start"
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) KEYS=2 COLS=2 \
+	  pgcopts+=' --slim' sanity_pg
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) KEYS=2 COLS=2 crtopts+=' -P 4' \
+	  pgcopts+=' --slim' sanity_pg
+	PGC_SQLITE_LOAD_EXTENSION=/usr/local/lib/sqlite_checksum.so \
+	  $(MAKE) AUTH1=$(auth3) AUTH2=$(auth3) DB=base.db KEYS=2 COLS=2 \
+	    pgcopts+=' --slim' sanity_lite
+	@echo "# $@ done"
+
+# two round sketches, falling back to summary tables on many differences
+# 3*3 = 9 runs
+.PHONY: validate_iblt
+validate_iblt:
+	@echo "# $@ start"
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) pgcopts+=' --iblt=10' sanity_pg
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth2) xor=sum pgcopts+=' --iblt=10' \
+	  sanity_mix
+	PGC_SQLITE_LOAD_EXTENSION=/usr/local/lib/sqlite_checksum.so \
+	  $(MAKE) AUTH1=$(auth3) AUTH2=$(auth3) DB=base.db \
+	    pgcopts+=' --iblt=10' sanity_lite
+	@echo "# $@ done"
+
+# exported and imported reference trees
+# 3*2 = 6 runs
+.PHONY: validate_tree
+validate_tree:
+	@echo "# $@ start"
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) KEYS=1 COLS=2 run_tree
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) pgcopts+=' -u' run_tree
+	PGC_SQLITE_LOAD_EXTENSION=/usr/local/lib/sqlite_checksum.so \
+	  $(MAKE) AUTH1=$(auth3) AUTH2=$(auth3) DB=base.db KEYS=1 COLS=2 \
+	    run_tree
+	@echo "# $@ done"
+
+# sharded synchronization with a two-phase commit
+# 3*2 = 6 runs
+.PHONY: validate_sync_jobs
+validate_sync_jobs:
+	@echo "# $@ start"
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) \
+	  pgcopts+=' --sync-jobs=3 --no-join' sanity_pg
+	$(MAKE) AUTH1=$(auth2) AUTH2=$(auth2) ENGINE='INNODB' \
+	  pgcopts+=' --sync-jobs=3 --no-join' sanity_my
+	@echo "# $@ done"
+
+# consistent snapshots instead of table locks
+# 3*3 = 9 runs
+.PHONY: validate_snapshot
+validate_snapshot:
+	@echo "# $@ start"
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth1) pgcopts+=' --snapshot --no-join' \
+	  sanity_pg
+	$(MAKE) AUTH1=$(auth2) AUTH2=$(auth2) ENGINE='INNODB' \
+	  pgcopts+=' --snapshot' sanity_my
+	$(MAKE) AUTH1=$(auth1) AUTH2=$(auth2) ENGINE='INNODB' \
+	  pgcopts+=' --snapshot' sanity_mix
 	@echo "# $@ done"
 
 # some options may not work as expected depending on the engine...
@@ -451,19 +606,22 @@ validate_quote:
 	$(MAKE) tab1=\`foo1\` tab2=\`foo2\`            ROWS=10 validate_my
 	@echo "# $@ done"
 
-# basic test with sqlite3
+# basic test with sqlite3, with and without the join
 # note: ROWS=500 => too many terms in compound SELECT statement,
 #       because of the many INSERT values.
-# 12*3 = 36 runs
+# 14*3 + 3 = 45 runs
 .PHONY: validate_sqlite
 validate_sqlite:
 	@echo "# $@ start"
 	PGC_SQLITE_LOAD_EXTENSION=/usr/local/lib/sqlite_checksum.so \
 	  $(MAKE) AUTH1=$(auth3) AUTH2=$(auth3) DB=base.db ROWS=10 fast_lite
+	PGC_SQLITE_LOAD_EXTENSION=/usr/local/lib/sqlite_checksum.so \
+	  $(MAKE) AUTH1=$(auth3) AUTH2=$(auth3) DB=base.db ROWS=10 \
+	    pgcopts+=' --join --no-lock' sanity_lite
 	@echo "# $@ done"
 
 # basic test with firebird, not included in feature
-# 12*3 = 36 runs
+# 14*3 = 42 runs
 .PHONY: validate_firebird
 validate_firebird:
 	@echo "# $@ start"
@@ -471,7 +629,7 @@ validate_firebird:
 	@echo "# $@ done"
 
 # sqlite/mysql
-# 12*3 = 36 runs
+# 14*3 = 42 runs
 .PHONY: validate_mylite
 validate_mylite:
 	@echo "# $@ start"
@@ -484,7 +642,7 @@ validate_mylite:
 	@echo "# $@ done"
 
 # sqlite/pgsql
-# 12*3 = 36 runs
+# 14*3 = 42 runs
 .PHONY: validate_pglite
 validate_pglite:
 	@echo "# $@ start"
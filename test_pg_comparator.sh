@@ -19,7 +19,7 @@ seed=$(date +%s)
 create= modify= cmp=
 
 # misc
-auth= keep= eng= debug= trigger= empty1= empty2= nullkey=
+auth= keep= eng= debug= trigger= empty1= empty2= nullkey= parts=
 
 # default diffs
 upt=2 ins=2 del=2 nul=2 rev=1 notnull= total=
@@ -45,6 +45,7 @@ while [[ "$1" && "$1" != '--' ]] ; do
     --width|-w) width=$1 ; shift ;; # about 17 (up to 18) chars per w
     --engine|-e) eng=$1 ; shift ;; # for mysql only
     --null-key|-nk) nullkey=' --null-key' ;;
+    --partitions|-P) parts=" --partitions $1" ; shift ;; # for pgsql only
     --tuple-trigger|--tt|-T) trigger+=' --tc=tup_cs --no-null' ;;
     --key-trigger|--kt) trigger+=' --kc=key_cs --no-null' ;;
     --empty-1|--e1) empty1=1 ;;
@@ -77,6 +78,7 @@ while [[ "$1" && "$1" != '--' ]] ; do
 	" -c cols: number of data columns\n" \
 	" -w width: horizontal size (17 chars per unit)\n" \
 	" -t total: number of differences to generate\n" \
+	" -P parts: number of hash partitions, pgsql only\n" \
         " -K: keep resulting table\n" \
         " -C: create\n" \
 	" -M: modify\n" \
@@ -164,13 +166,14 @@ function create_table()
   local db=$1 name=$2 seed=$3 rows=$4 keys=$5 cols=$6 width=$7 eng=$8
   shift 8
 
-  local engine=
+  local engine= partitions=
   [ $db = 'mysql' -a "$eng" ] && engine="--engine $eng"
+  [ $db = 'pgsql' ] && partitions=$parts
 
   # create and fill tables
   rand_table.pl --$db --table ${name} --seed $seed --rows $rows \
 	--keys=$keys --columns=$cols --width $width --transaction \
-        $engine $trigger $nullkey
+        $engine $trigger $nullkey $partitions
 
   return 0;
 }